@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+
+
+class CancellationSource;
+
+//cheap to copy view of a CancellationSource. a default constructed token is never cancelled.
+//a token only refers to the round of its source it was created in: once the source is reset,
+//tokens of earlier rounds stay cancelled.
+class CancellationToken {
+    CancellationSource const* source = nullptr;
+    std::uint64_t generation = 0;
+
+    friend class CancellationSource;
+    friend class CancelCallback;
+
+    constexpr CancellationToken(CancellationSource const* const source, std::uint64_t const generation)
+        :source(source), generation(generation)
+    {}
+
+public:
+    constexpr CancellationToken() = default;
+
+    bool is_cancelled() const;
+}; //class CancellationToken
+
+
+//registers a cleanup action for as long as it lives. runs it at most once, when the token is cancelled
+//(or right away in the constructor, if the token is already cancelled).
+//intrusive, thus registering neither allocates nor depends on the number of registered callbacks.
+class CancelCallback {
+    CancelCallback* next = nullptr;
+    CancelCallback** prev_next = nullptr; //nullptr if not registered
+    void (*callback)(void*);
+    void* context;
+
+    friend class CancellationSource;
+
+    void unlink() {
+        if (this->prev_next) {
+            *this->prev_next = this->next;
+            if (this->next) this->next->prev_next = this->prev_next;
+            this->next = nullptr;
+            this->prev_next = nullptr;
+        }
+    }
+
+public:
+    CancelCallback(CancellationToken const token, void (*const callback)(void*), void* const context);
+
+    CancelCallback(CancelCallback const&) = delete;
+    CancelCallback& operator=(CancelCallback const&) = delete;
+
+    ~CancelCallback() { this->unlink(); }
+}; //class CancelCallback
+
+
+class CancellationSource {
+    mutable CancelCallback* callbacks = nullptr; //registering does not change the observable state
+    std::uint64_t generation = 0;
+    bool cancelled = false;
+
+    friend class CancellationToken;
+    friend class CancelCallback;
+
+public:
+    constexpr CancellationSource() {}
+
+    CancellationSource(CancellationSource const&) = delete;
+    CancellationSource& operator=(CancellationSource const&) = delete;
+
+    CancellationToken token() const { return CancellationToken(this, this->generation); }
+    bool is_cancelled() const { return this->cancelled; }
+
+    //runs every registered callback, only the first call after construction or reset has an effect
+    void cancel() {
+        if (this->cancelled) return;
+        this->cancelled = true;
+        while (this->callbacks) {
+            CancelCallback* const cb = this->callbacks;
+            cb->unlink();
+            cb->callback(cb->context);
+        }
+    }
+
+    //starts a new round. tokens handed out before stay cancelled.
+    void reset() {
+        if (this->cancelled) {
+            this->cancelled = false;
+            this->generation++;
+        }
+    }
+}; //class CancellationSource
+
+
+inline bool CancellationToken::is_cancelled() const {
+    return this->source && (this->source->cancelled || this->source->generation != this->generation);
+}
+
+inline CancelCallback::CancelCallback(CancellationToken const token, void (*const callback)(void*), void* const context)
+    :callback(callback), context(context)
+{
+    if (token.is_cancelled()) {
+        callback(context);
+    }
+    else if (token.source) {
+        CancelCallback*& head = token.source->callbacks;
+        this->next = head;
+        this->prev_next = &head;
+        if (head) head->prev_next = &this->next;
+        head = this;
+    }
+}
+
+
+//CancelCallback running a function object, e.g. a lambda
+template<typename F>
+class OnCancel {
+    F action;
+    CancelCallback registration;
+
+public:
+    OnCancel(CancellationToken const token, F action)
+        :action(std::move(action)),
+        registration(token, [](void* self) { ((OnCancel*)self)->action(); }, this)
+    {}
+}; //class OnCancel
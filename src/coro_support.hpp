@@ -4,6 +4,18 @@
 #include <exception>
 #include <concepts>
 #include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+#include <ostream>
+#include <limits>
+#include <type_traits>
+
+#include "timer_wheel.hpp"
+#include "units.hpp"
+#include "cancellation.hpp"
 
 
 struct GlobalOwner {}; //signals usual heap allocation of the coroutine state
@@ -11,48 +23,360 @@ struct GlobalOwner {}; //signals usual heap allocation of the coroutine state
 //coroutines can call each other. one such call chain behaves exactly like the usual call stack
 // , as long as no coroutine manages multiple coroutines simultaniously itself.
 //for that special case, one can circumvent heap allocation and give each such call chain its own stack.
+//an owner running several call chains at once (e.g. moving while supervising the gripper) may split its stack
+//into named sub-stacks by declaring e.g. static constexpr std::array coroutines_sub_stacks = { "move", "gripper" };
 template<typename T>
 concept CallstackOwner = std::is_same_v<T, GlobalOwner> || requires {
     { T::coroutines_stack_size } -> std::convertible_to<std::size_t>;
     { T::name } -> std::convertible_to<char const*>;
 };
 
-//there is only one callstack per type, as coroutines are unable to get an allocator object passed in the constructor.
-// thus everything here is static.
+template<CallstackOwner O>
+constexpr std::size_t nr_sub_stacks() {
+    if constexpr (requires { O::coroutines_sub_stacks.size(); }) {
+        return O::coroutines_sub_stacks.size();
+    }
+    else {
+        return 1;
+    }
+}
+
+template<CallstackOwner O>
+constexpr char const* sub_stack_name(std::size_t const sub_stack) {
+    if constexpr (requires { O::coroutines_sub_stacks.size(); }) {
+        return O::coroutines_sub_stacks[sub_stack];
+    }
+    else {
+        return O::name;
+    }
+}
+
+//new coroutine frames are placed on the sub-stack of the coroutine currently running (0 outside of any coroutine).
+//a call chain is moved to another sub-stack by creating its first coroutine while a SubStackScope lives.
+class SubStackScope {
+    static inline constinit thread_local std::size_t curr = 0;
+    std::size_t prev;
+
+public:
+    SubStackScope(std::size_t const sub_stack) :prev(curr) { curr = sub_stack; }
+    ~SubStackScope() { curr = this->prev; }
+
+    SubStackScope(SubStackScope const&) = delete;
+    SubStackScope& operator=(SubStackScope const&) = delete;
+
+    static std::size_t current() { return curr; }
+};
+
+//there is only one callstack per type (and thread), as coroutines are unable to get an allocator object passed
+// in the constructor. thus everything here is static.
+//the arena is split evenly into the sub-stacks of the owner, each growing independently.
+//frames are only ever taken from the arena, giving them back is the job of FramePool.
 template<CallstackOwner O>
 class CoroutineStack {
-    constinit inline static std::size_t start_unused = 0;
+    static constexpr std::size_t nr_stacks = nr_sub_stacks<O>();
+    static constexpr std::size_t segment_size = O::coroutines_stack_size / nr_stacks;
+    static_assert(segment_size > 0);
+
+    //per sub-stack: index in arena of the first unused element
+    constinit inline static thread_local std::array<std::size_t, nr_stacks> start_unused = [] {
+        std::array<std::size_t, nr_stacks> starts = {};
+        for (std::size_t i = 0; i < nr_stacks; i++) {
+            starts[i] = i * segment_size;
+        }
+        return starts;
+    }();
     //std::size_t has pointer allignment -> every element of arena has pointer allignment 
     // and can thus be a valid starting position for requested space 
     // (as long as no artificial allignment was specified for the type allocated...)
-    constinit inline static std::array<std::size_t, O::coroutines_stack_size> arena = {};
+    constinit inline static thread_local std::array<std::size_t, O::coroutines_stack_size> arena = {};
+
+public:
     static constexpr auto elem_size = sizeof(std::size_t);
 
-    static void* next_address() {
-        return &arena[start_unused];
+    static void* allocate_words(std::size_t const sub_stack, std::size_t const nr_needed) {
+        assert(sub_stack < nr_stacks);
+        std::size_t& start = start_unused[sub_stack];
+        auto const new_start_unused = start + nr_needed;
+        assert(new_start_unused <= (sub_stack + 1) * segment_size);
+        void* const result = &arena[start];
+        start = new_start_unused;
+        return result;
+    }
+
+    static std::size_t sub_stack_of(void const* const address) {
+        return ((std::size_t const*)address - arena.data()) / segment_size;
+    }
+
+    //in elements of elem_size
+    static std::size_t used(std::size_t const sub_stack) { return start_unused[sub_stack] - sub_stack * segment_size; }
+    static constexpr std::size_t capacity(std::size_t) { return segment_size; }
+};
+
+struct FramePoolStats {
+    std::uint64_t hits = 0;   //frames taken from a free list
+    std::uint64_t misses = 0; //frames taken from the arena (or the heap)
+    std::size_t nr_live = 0;
+    std::size_t max_live = 0;
+
+    void print(std::ostream& out, char const* const name) const {
+        std::uint64_t const total = this->hits + this->misses;
+        out << name << " frames: " << total << " allocated, " << this->hits << " reused ("
+            << (total ? 100 * this->hits / total : 0) << "%), at most " << this->max_live << " alive\n";
+    }
+};
+
+//the same coroutines are created over and over (e.g. four times go_to per box),
+//thus a frame is not given back when its coroutine ends, but kept in a free list of frames of the same size.
+//creating a coroutine the next time then only pops the free list.
+//as frames never go back to the arena, they may also be freed in any order.
+//the arena only grows to the largest number of frames of each size alive at the same time.
+//each sub-stack has its own free lists, thus the memory one call chain needs does not depend on the others.
+template<CallstackOwner O>
+class FramePool {
+    struct FreeFrame { FreeFrame* next; };
+    struct SizeClass {
+        std::size_t nr_words = 0; //0 if unused
+        FreeFrame* free = nullptr;
+    };
+    //every coroutine function has its own frame size, owners only have a handful of them
+    static constexpr std::size_t max_size_classes = 16;
+    static constexpr auto elem_size = sizeof(std::size_t);
+    static constexpr std::size_t nr_stacks = nr_sub_stacks<O>();
+
+    constinit inline static thread_local std::array<std::array<SizeClass, max_size_classes>, nr_stacks> classes = {};
+    constinit inline static thread_local std::array<FramePoolStats, nr_stacks> stats = {};
+
+    static SizeClass& size_class(std::size_t const sub_stack, std::size_t const nr_words) {
+        for (SizeClass& c : classes[sub_stack]) {
+            if (c.nr_words == nr_words) return c;
+            if (c.nr_words == 0) {
+                c.nr_words = nr_words;
+                return c;
+            }
+        }
+        //a frame of another size would be handed out. raise max_size_classes.
+        assert(false && "too many different frame sizes");
+        std::abort();
+    }
+
+    static void* fresh_frame(std::size_t const sub_stack, std::size_t const nr_words) {
+        if constexpr (std::is_same_v<O, GlobalOwner>) {
+            return ::operator new(nr_words * elem_size);
+        }
+        else {
+            return CoroutineStack<O>::allocate_words(sub_stack, nr_words);
+        }
+    }
+
+    static std::size_t sub_stack_of(void const* const address) {
+        if constexpr (std::is_same_v<O, GlobalOwner>) {
+            return 0;
+        }
+        else {
+            return CoroutineStack<O>::sub_stack_of(address);
+        }
     }
 
 public:
-    static void* allocate(std::size_t n) {
+    static void* allocate(std::size_t const n) {
+        //the heap has no sub-stacks
+        std::size_t const sub_stack = std::is_same_v<O, GlobalOwner> ? 0 : SubStackScope::current();
+        assert(sub_stack < nr_stacks);
         //n is given in bytes -> choose smallest multiple of std::size_t large enough to fit n bytes
-        auto const nr_needed = (n + elem_size - 1) / elem_size;
-        auto const new_start_unused = start_unused + nr_needed;
-        assert(new_start_unused <= arena.size());
-        void* const result = next_address();
-        start_unused = new_start_unused;
-        std::cout << "ALLOC " << nr_needed << " for " << O::name << "\n";
-        return result;
+        std::size_t const nr_words = (n + elem_size - 1) / elem_size;
+        SizeClass& c = size_class(sub_stack, nr_words);
+        FramePoolStats& s = stats[sub_stack];
+        s.max_live = std::max(s.max_live, ++s.nr_live);
+        if (c.free) {
+            FreeFrame* const frame = c.free;
+            c.free = frame->next;
+            s.hits++;
+            return frame;
+        }
+        s.misses++;
+        return fresh_frame(sub_stack, nr_words);
+    }
+
+    static void deallocate(void* const address, std::size_t const n) {
+        std::size_t const sub_stack = sub_stack_of(address);
+        std::size_t const nr_words = (n + elem_size - 1) / elem_size;
+        SizeClass& c = size_class(sub_stack, nr_words);
+        FreeFrame* const frame = new (address) FreeFrame{ c.free };
+        c.free = frame;
+        stats[sub_stack].nr_live--;
     }
 
-    static void deallocate(void* address) {
-        assert(address < next_address());
-        std::size_t const as_arena_index = (std::size_t*)address - arena.data();
-        std::cout << "FREE " << (start_unused - as_arena_index) << " for " << O::name << "\n";
-        assert(as_arena_index < arena.size());
-        start_unused = as_arena_index;
+    static FramePoolStats const& statistics(std::size_t const sub_stack = 0) { return stats[sub_stack]; }
+
+    static void print_stats(std::ostream& out) {
+        for (std::size_t i = 0; i < nr_stacks; i++) {
+            stats[i].print(out, sub_stack_name<O>(i));
+        }
     }
+}; //class FramePool
+
+//state every promise shares, independent of the CallstackOwner
+struct PromiseBase {
+    //tick the coroutine wants to be resumed at next, 0 (or anything not in the future) means next tick
+    std::uint64_t wake_tick = 0;
+    //inherited from the caller, see EXEC_WHILE and EXEC_UNTIL_CANCELLED
+    CancellationToken token = {};
+    //sub-stack the frame lives on, also used for every coroutine this one creates
+    std::size_t sub_stack = SubStackScope::current();
+};
+
+//suspends the current coroutine until tick (or for one tick, if tick is not in the future)
+struct WakeAt {
+    std::uint64_t tick;
+
+    bool await_ready() const { return false; }
+    template<std::derived_from<PromiseBase> P>
+    void await_suspend(std::coroutine_handle<P> const h) const { h.promise().wake_tick = this->tick; }
+    void await_resume() const {}
+};
+
+//co_await current_token() evaluates to the cancellation token of the current coroutine without suspending it
+struct CurrentToken {
+    CancellationToken token = {};
+
+    bool await_ready() const { return false; }
+    template<std::derived_from<PromiseBase> P>
+    bool await_suspend(std::coroutine_handle<P> const h) {
+        this->token = h.promise().token;
+        return false;
+    }
+    CancellationToken await_resume() const { return this->token; }
+};
+
+inline CurrentToken current_token() { return {}; }
+
+
+struct ScheduledTask {
+    std::coroutine_handle<> handle = nullptr;
+    PromiseBase* promise = nullptr;
+    bool sleeping = false;
+    TimerNode wake_timer = { [](void* task) { ((ScheduledTask*)task)->sleeping = false; }, this };
+
+    ScheduledTask() = default;
+    ScheduledTask(ScheduledTask const&) = delete;
 };
 
+//executes the top level coroutines once per tick, in the order they where spawned.
+//coroutines waiting for a later tick are not resumed, but wait in a timer wheel until their tick has come,
+//thus a sleeping coroutine costs nothing per tick.
+class Scheduler {
+    static constexpr std::size_t max_tasks = 16;
+
+    using Task = ScheduledTask;
+
+    static inline constinit thread_local TimerWheel wheel = {};
+    static inline thread_local std::array<Task, max_tasks> tasks = {};
+    static inline constinit thread_local std::size_t nr_tasks = 0;
+    static inline constinit thread_local Task* curr_task = nullptr;
+    static inline constinit thread_local std::chrono::nanoseconds period = std::chrono::milliseconds(10);
+
+public:
+    static std::uint64_t now() { return wheel.now(); }
+    static std::chrono::nanoseconds tick_period() { return period; }
+    static void set_tick_period(std::chrono::nanoseconds const p) { period = p; }
+
+    //smallest number of ticks lasting at least duration
+    static Ticks to_ticks(std::chrono::nanoseconds const duration) {
+        return Ticks((duration.count() + period.count() - 1) / period.count());
+    }
+    static std::chrono::nanoseconds to_duration(Ticks const duration) { return period * duration.count(); }
+
+    //points in time are plain tick numbers as now() returns them, only their distance is a Ticks
+    static std::uint64_t after(Ticks const duration) { return now() + (std::uint64_t)duration.count(); }
+    static Ticks since(std::uint64_t const tick) { return Ticks((std::int64_t)(now() - tick)); }
+    //zero if tick has passed
+    static Ticks until(std::uint64_t const tick) { return tick > now() ? Ticks((std::int64_t)(tick - now())) : Ticks(0); }
+
+    static TimerWheel& timers() { return wheel; }
+
+    //the task currently resumed, nullptr outside of run_tick
+    static Task* current_task() { return curr_task; }
+
+    //the task is resumed in the next tick, even if it wanted to sleep longer
+    static void wake(Task& task) {
+        TimerWheel::cancel(task.wake_timer);
+        task.sleeping = false;
+    }
+
+    //the coroutine is not owned by the scheduler, it has to stay alive until clear is called
+    template<std::derived_from<PromiseBase> P>
+    static void spawn(std::coroutine_handle<P> const handle) {
+        assert(nr_tasks < max_tasks);
+        Task& task = tasks[nr_tasks++];
+        task.handle = handle;
+        task.promise = &handle.promise();
+        task.sleeping = false;
+    }
+
+    static void clear() {
+        for (std::size_t i = 0; i < nr_tasks; i++) {
+            TimerWheel::cancel(tasks[i].wake_timer);
+            tasks[i].handle = nullptr;
+            tasks[i].promise = nullptr;
+        }
+        nr_tasks = 0;
+    }
+
+    //resumes every task not sleeping, then advances the clock by one tick
+    static void run_tick() {
+        std::uint64_t const curr = now();
+        for (std::size_t i = 0; i < nr_tasks; i++) {
+            Task& task = tasks[i];
+            if (task.sleeping || task.handle.done()) continue;
+            curr_task = &task;
+            SubStackScope const scope(task.promise->sub_stack);
+            task.handle();
+            curr_task = nullptr;
+            if (!task.handle.done() && task.promise->wake_tick > curr + 1) {
+                task.sleeping = true;
+                wheel.insert(task.wake_timer, task.promise->wake_tick);
+            }
+        }
+        wheel.advance(curr + 1);
+    }
+}; //class Scheduler
+
+inline WakeAt delay(std::chrono::nanoseconds const duration) {
+    return WakeAt{ Scheduler::after(Scheduler::to_ticks(duration)) };
+}
+
+//set once the given time has passed since construction. backed by the timer wheel of the scheduler,
+//thus checking costs nothing and a timeout that is destroyed before it expired costs nothing either.
+class Timeout {
+    bool has_expired = false;
+    TimerNode timer = { [](void* self) { ((Timeout*)self)->has_expired = true; }, this };
+
+public:
+    Timeout(std::chrono::nanoseconds const duration) {
+        Scheduler::timers().insert(this->timer, Scheduler::after(Scheduler::to_ticks(duration)));
+    }
+
+    Timeout(Timeout const&) = delete;
+    ~Timeout() { TimerWheel::cancel(this->timer); }
+
+    bool expired() const { return this->has_expired; }
+}; //class Timeout
+
+//wakes the current task, if token is cancelled while it lives.
+//allows a sleeping task to react to cancellation in the next tick.
+class WakeOnCancel {
+    ScheduledTask* task = Scheduler::current_task();
+    CancelCallback registration;
+
+public:
+    WakeOnCancel(CancellationToken const token)
+        :registration(token, [](void* self) {
+            ScheduledTask* const task = ((WakeOnCancel*)self)->task;
+            if (task) Scheduler::wake(*task);
+        }, this)
+    {}
+}; //class WakeOnCancel
+
 
 //return type for coroutine type below
 //not returning any information is important, as this allows us call the coroutine exactly when
@@ -68,8 +392,9 @@ struct SideEffectCoroutine
 {
     struct promise_type;
     using handle_type = std::coroutine_handle<promise_type>;
+    using Owner = O;
 
-    struct promise_type
+    struct promise_type : PromiseBase
     {
         SideEffectCoroutine get_return_object()
         {
@@ -79,16 +404,19 @@ struct SideEffectCoroutine
         std::suspend_always final_suspend() noexcept { return {}; }
         void unhandled_exception() {} // exceptions are not expected here
 
-        std::suspend_always yield_value(Void) { return {}; }
+        std::suspend_always yield_value(Void) {
+            this->wake_tick = 0;
+            return {};
+        }
         void return_void() { }
 
-        void* operator new(std::size_t n) requires (!std::is_same_v<O, GlobalOwner>)
+        void* operator new(std::size_t n)
         {
-            return CoroutineStack<O>::allocate(n);
+            return FramePool<O>::allocate(n);
         }
 
-        void operator delete(void* address) requires (!std::is_same_v<O, GlobalOwner>) {
-            CoroutineStack<O>::deallocate(address);
+        void operator delete(void* address, std::size_t n) {
+            FramePool<O>::deallocate(address, n);
         }
     };
 
@@ -98,23 +426,135 @@ struct SideEffectCoroutine
     ~SideEffectCoroutine() { this->handle.destroy(); }
 
     explicit operator bool() { return !this->handle.done(); }
-    void operator()() { this->handle(); }
+    void operator()() {
+        SubStackScope const scope(this->handle.promise().sub_stack);
+        this->handle();
+    }
+
+    //tick this coroutine wants to be resumed at next
+    WakeAt next_step() const { return WakeAt{ this->handle.promise().wake_tick }; }
+
+    void set_token(CancellationToken const token) { this->handle.promise().token = token; }
 }; //class SideEffectCoroutine
 
+//creates the coroutine returned by make on the sub-stack after the current one, if its owner has that many.
+//thus parallel children of an owner with sub-stacks each get their own (see EXEC_ALL and EXEC_ANY).
+template<typename F>
+auto make_on_next_sub_stack(F const& make) {
+    using O = typename std::invoke_result_t<F const&>::Owner;
+    std::size_t const curr = SubStackScope::current();
+    SubStackScope const scope(curr + 1 < nr_sub_stacks<O>() ? curr + 1 : curr);
+    return make();
+}
+
+//one step of a parallel composition: resumes every unfinished child due in the current tick.
+//returns the earliest tick an unfinished child wants to be resumed at.
+template<typename... Children>
+std::uint64_t step_children(Children&... children) {
+    std::uint64_t const curr = Scheduler::now();
+    std::uint64_t next = std::numeric_limits<std::uint64_t>::max();
+    auto const step = [&](auto& child) {
+        if (!child) return;
+        if (child.handle.promise().wake_tick <= curr) {
+            child();
+        }
+        if (child) {
+            next = std::min(next, std::max(child.handle.promise().wake_tick, curr + 1));
+        }
+    };
+    (step(children), ...);
+    return next;
+}
+
 //simplify implementation of coroutine type above by hiding the trivial return value
 //these are macros, because the whole point of coroutines is to not behave like functions.
 #define WAIT_WHILE(x) while (x) co_yield Void{}
 #define YIELD co_yield Void{}
 
+//waits while cond is true, but at most for duration. timed_out is set to whether cond was still true in the end.
+#define WAIT_WHILE_FOR(cond, duration, timed_out) {\
+    Timeout wait_timeout(duration);\
+    while ((cond) && !wait_timeout.expired()) co_yield Void{};\
+    timed_out = (cond);\
+}
+
+#define CORO_CONCAT_IMPL(a, b) a##b
+#define CORO_CONCAT(a, b) CORO_CONCAT_IMPL(a, b)
+
+//runs the given statements once the current coroutines token is cancelled, for as long as the current scope lives.
+//meant for cleanup, e.g. stopping the axes a coroutine has set in motion.
+#define ON_CANCEL(...) OnCancel CORO_CONCAT(on_cancel_, __LINE__)(co_await current_token(), [&] { __VA_ARGS__; })
+
 //assumes init is an expression returning SideEffectCoroutine.
 //executes one step of that coroutine until it has finished or cond is no longer true.
 //(thus assumes usage inside a coroutine itself)
+//if the child sleeps, the caller sleeps as long. once the child has finished, the caller continues in the same tick,
+//thus splitting a coroutine into several costs no time.
+//the child inherits the callers cancellation token. once that is cancelled, the caller returns as well,
+//in the same tick the cancellation is noticed by the child, no matter how deep the nesting.
 #define EXEC_WHILE(cond, init) {\
+    CancellationToken const exec_token = co_await current_token();\
     SideEffectCoroutine coro_f = init;\
+    coro_f.set_token(exec_token);\
     while ((cond) && coro_f) {\
         coro_f();\
-        co_yield Void{};\
+        if (exec_token.is_cancelled()) co_return;\
+        if (!coro_f) break;\
+        co_await coro_f.next_step();\
     }\
+    if (exec_token.is_cancelled()) co_return;\
 }
 
 #define EXEC(init) EXEC_WHILE(true, init)
+
+//executes init (as EXEC) with token as cancellation token of init and everything init calls.
+//stops at the latest in the tick after token is cancelled, even if init sleeps. the caller continues afterwards.
+#define EXEC_UNTIL_CANCELLED(token, init) {\
+    CancellationToken const exec_token = token;\
+    SideEffectCoroutine coro_f = init;\
+    coro_f.set_token(exec_token);\
+    WakeOnCancel const exec_wake(exec_token);\
+    while (!exec_token.is_cancelled() && coro_f) {\
+        coro_f();\
+        if (exec_token.is_cancelled() || !coro_f) break;\
+        co_await coro_f.next_step();\
+    }\
+}
+
+//executes init_a and init_b in parallel until both have finished.
+//a child sleeping is not resumed until its tick has come, the caller sleeps until the first child is due.
+//both children inherit the callers cancellation token, as with EXEC.
+//no allocation besides the two frames, init_b is created on the next sub-stack of its owner (if there is one).
+#define EXEC_ALL(init_a, init_b) {\
+    CancellationToken const exec_token = co_await current_token();\
+    SideEffectCoroutine coro_a = init_a;\
+    SideEffectCoroutine coro_b = make_on_next_sub_stack([&] { return init_b; });\
+    coro_a.set_token(exec_token);\
+    coro_b.set_token(exec_token);\
+    while (coro_a || coro_b) {\
+        std::uint64_t const exec_wake = step_children(coro_a, coro_b);\
+        if (exec_token.is_cancelled()) co_return;\
+        if (!coro_a && !coro_b) break;\
+        co_await WakeAt{ exec_wake };\
+    }\
+}
+
+//as EXEC_ALL, but stops as soon as one of the children has finished. the other one is cancelled (thus its ON_CANCEL
+//cleanups run, e.g. a losing move stops its axis) and destroyed unfinished.
+//the children get a token of their own, cancelled as well once the callers token is.
+#define EXEC_ANY(init_a, init_b) {\
+    CancellationToken const exec_token = co_await current_token();\
+    CancellationSource exec_children;\
+    OnCancel const exec_chain(exec_token, [&] { exec_children.cancel(); });\
+    SideEffectCoroutine coro_a = init_a;\
+    SideEffectCoroutine coro_b = make_on_next_sub_stack([&] { return init_b; });\
+    coro_a.set_token(exec_children.token());\
+    coro_b.set_token(exec_children.token());\
+    while (coro_a && coro_b) {\
+        std::uint64_t const exec_wake = step_children(coro_a, coro_b);\
+        if (exec_token.is_cancelled()) co_return;\
+        if (!coro_a || !coro_b) break;\
+        co_await WakeAt{ exec_wake };\
+    }\
+    exec_children.cancel();\
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <span>
+#include <chrono>
+#include <thread>
+#include <ostream>
+#include <new>
+
+#include "mapped_file.hpp"
+#include "process_image.hpp"
+#include "seqlock.hpp"
+#include "stats.hpp"
+
+
+//cyclic exchange of the process image with a separate process simulating the devices, as it would happen
+//with an EtherCAT like fieldbus: once per tick the master sends one frame containing the outputs of all devices,
+//the slave answers with one frame containing all inputs.
+//frames are exchanged over shared memory, the slave process is expected to create the segment.
+
+struct PdoFrameHeader {
+    std::uint64_t counter;        //cycle number, echoed by the slave
+    std::int64_t master_sent_ns;  //steady clock, echoed by the slave
+    std::int64_t slave_sent_ns;   //steady clock
+    std::uint16_t payload_size;
+    std::uint8_t nr_motors;
+    std::uint8_t nr_pistons;
+    std::uint32_t reserved;
+};
+
+//only the devices in use are sent, packed without padding
+constexpr std::size_t max_pdo_payload = max_motors * sizeof(MotorInputs) + max_pistons * sizeof(PistonInputs);
+static_assert(max_pdo_payload >= max_motors * sizeof(MotorOutputs) + max_pistons * sizeof(PistonOutputs));
+
+struct PdoFrame {
+    PdoFrameHeader header;
+    std::array<std::byte, max_pdo_payload> payload;
+
+    std::size_t size() const { return sizeof(PdoFrameHeader) + this->header.payload_size; }
+};
+
+struct FieldbusSegment {
+    static constexpr std::array<char, 8> expected_magic = { 'P', 'A', 'L', 'F', 'B', 'U', 'S', '!' };
+    static constexpr std::uint32_t expected_version = 1;
+
+    std::array<char, 8> magic = expected_magic;
+    std::uint32_t version = expected_version;
+    Seqlock<PdoFrame> to_slave = {};
+    Seqlock<PdoFrame> to_master = {};
+};
+
+namespace fieldbus_detail {
+
+    inline std::int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //the first nr_motors motor entries and the first nr_pistons piston entries of image, one after the other
+    template<typename Image>
+    std::uint16_t pack(Image const& image, PdoFrame& frame) {
+        std::byte* dest = frame.payload.data();
+        for (std::size_t i = 0; i < ProcessImage::motor_count(); i++) {
+            std::memcpy(dest, &image.motors[i], sizeof(image.motors[i]));
+            dest += sizeof(image.motors[i]);
+        }
+        for (std::size_t i = 0; i < ProcessImage::piston_count(); i++) {
+            std::memcpy(dest, &image.pistons[i], sizeof(image.pistons[i]));
+            dest += sizeof(image.pistons[i]);
+        }
+        frame.header.nr_motors = (std::uint8_t)ProcessImage::motor_count();
+        frame.header.nr_pistons = (std::uint8_t)ProcessImage::piston_count();
+        frame.header.payload_size = (std::uint16_t)(dest - frame.payload.data());
+        return frame.header.payload_size;
+    }
+
+    //returns false if the frame was packed for a different set of devices
+    template<typename Image>
+    bool unpack(PdoFrame const& frame, Image& image) {
+        if (frame.header.nr_motors != ProcessImage::motor_count() || frame.header.nr_pistons != ProcessImage::piston_count()) {
+            return false;
+        }
+        std::byte const* src = frame.payload.data();
+        for (std::size_t i = 0; i < ProcessImage::motor_count(); i++) {
+            std::memcpy(&image.motors[i], src, sizeof(image.motors[i]));
+            src += sizeof(image.motors[i]);
+        }
+        for (std::size_t i = 0; i < ProcessImage::piston_count(); i++) {
+            std::memcpy(&image.pistons[i], src, sizeof(image.pistons[i]));
+            src += sizeof(image.pistons[i]);
+        }
+        return true;
+    }
+
+} //namespace fieldbus_detail
+
+
+class FieldbusMaster {
+    SharedMemory memory;
+    FieldbusSegment* segment = nullptr;
+    std::chrono::nanoseconds timeout;
+    std::uint64_t counter = 0;
+
+    RunningStats round_trip_us = {};
+    RunningStats slave_us = {}; //time between the slave receiving the outputs and sending the inputs (upper bound)
+    std::uint64_t nr_lost = 0;
+    std::size_t output_frame_size = 0;
+    std::size_t input_frame_size = 0;
+    std::size_t output_payload_size = 0;
+    std::size_t input_payload_size = 0;
+
+public:
+    FieldbusMaster(char const* const name, std::chrono::nanoseconds const timeout)
+        :memory(name, sizeof(FieldbusSegment), SharedMemory::Access::ReadWrite),
+        timeout(timeout)
+    {
+        FieldbusSegment* const seg = (FieldbusSegment*)this->memory.data();
+        if (seg && seg->magic == FieldbusSegment::expected_magic && seg->version == FieldbusSegment::expected_version) {
+            this->segment = seg;
+        }
+    }
+
+    explicit operator bool() const { return this->segment != nullptr; }
+
+    //replaces the local simulation: sends the outputs flushed by the last scan and waits for the slave to answer
+    //with its inputs. if there is no answer within timeout, the previous inputs stay in place.
+    void exchange() {
+        using namespace fieldbus_detail;
+        PdoFrame frame;
+        frame.header = {};
+        frame.header.counter = ++this->counter;
+        this->output_payload_size = pack(ProcessImage::field_output_image(), frame);
+        this->output_frame_size = frame.size();
+        frame.header.master_sent_ns = now_ns();
+        this->segment->to_slave.write(frame);
+
+        std::int64_t const deadline = frame.header.master_sent_ns + this->timeout.count();
+        while (true) {
+            PdoFrame reply;
+            if (this->segment->to_master.try_read(reply) && reply.header.counter == this->counter) {
+                std::int64_t const received_ns = now_ns();
+                if (!unpack(reply, ProcessImage::field_input_image())) break;
+                this->round_trip_us.add((received_ns - reply.header.master_sent_ns) / 1e3);
+                this->slave_us.add((reply.header.slave_sent_ns - reply.header.master_sent_ns) / 1e3);
+                this->input_payload_size = reply.header.payload_size;
+                this->input_frame_size = reply.size();
+                return;
+            }
+            if (now_ns() > deadline) break;
+            std::this_thread::yield();
+        }
+        this->nr_lost++;
+    }
+
+    void print_stats(std::ostream& out) const {
+        out << "fieldbus round trip: ";
+        this->round_trip_us.print(out, "us");
+        out << "fieldbus master -> slave -> reply sent: ";
+        this->slave_us.print(out, "us");
+        out << "fieldbus frames lost: " << this->nr_lost << " of " << this->counter << "\n";
+        auto const efficiency = [&](std::size_t const payload, std::size_t const frame) {
+            out << payload << " of " << frame << " bytes payload (" << (frame ? 100 * payload / frame : 0) << "%)";
+        };
+        out << "fieldbus frame packing: outputs ";
+        efficiency(this->output_payload_size, this->output_frame_size);
+        out << ", inputs ";
+        efficiency(this->input_payload_size, this->input_frame_size);
+        out << ", unpacked images would be " << sizeof(OutputImage) << " / " << sizeof(InputImage) << " bytes\n";
+    }
+}; //class FieldbusMaster
+
+
+//creates the segment and serves every frame of the master by running simulate once.
+//runs until the process is killed.
+inline int run_fieldbus_slave(char const* const name, void (*const simulate)()) {
+    using namespace fieldbus_detail;
+    SharedMemory memory(name, sizeof(FieldbusSegment), SharedMemory::Access::Create);
+    if (!memory) return 1;
+    FieldbusSegment* const segment = new (memory.data()) FieldbusSegment{};
+
+    std::uint64_t last_counter = 0;
+    while (true) {
+        PdoFrame frame;
+        if (segment->to_slave.try_read(frame) && frame.header.counter != last_counter) {
+            last_counter = frame.header.counter;
+            if (unpack(frame, ProcessImage::field_output_image())) {
+                ProcessImage::mark_all_outputs_changed();
+                simulate();
+                PdoFrame reply;
+                reply.header = frame.header;
+                pack(ProcessImage::field_input_image(), reply);
+                reply.header.slave_sent_ns = now_ns();
+                segment->to_master.write(reply);
+            }
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <algorithm>
+#include <limits>
+
+#include "units.hpp"
+
+
+//axis parallel rectangle in the x-y plane, x0 and y0 included, x1 and y1 excluded
+struct Rect {
+    Length x0, y0, x1, y1;
+
+    static constexpr Rect centered(Length const x, Length const y, Length const size) {
+        return Rect{ x - size / 2, y - size / 2, x - size / 2 + size, y - size / 2 + size };
+    }
+};
+
+//top surface of whatever stands on an area (e.g. the boxes on a palette), sampled on a grid of square cells.
+//z grows downward as for the arm: the top of an empty cell is the floor, stacking decreases it.
+//every operation only touches the cells under the given rectangle, thus the map is cheap enough to query every tick.
+template<std::size_t nr_cells_x, std::size_t nr_cells_y>
+class HeightMap {
+    Length origin_x;  //corner of cell (0, 0)
+    Length origin_y;
+    Length cell_size;
+    Length floor;
+    std::array<Length, nr_cells_x * nr_cells_y> tops;
+
+    struct Cells { std::size_t x0, y0, x1, y1; };
+
+    //cells overlapped by rect, clipped to the map (thus maybe empty)
+    constexpr Cells cells_of(Rect const& rect) const {
+        auto const first = [&](Length const v, Length const origin, std::size_t const n) {
+            return (std::size_t)std::clamp<std::int64_t>((v - origin) / this->cell_size, 0, (std::int64_t)n);
+        };
+        auto const last = [&](Length const v, Length const origin, std::size_t const n) {
+            return (std::size_t)std::clamp<std::int64_t>(ceil_div(v - origin, this->cell_size), 0, (std::int64_t)n);
+        };
+        return Cells{
+            first(rect.x0, this->origin_x, nr_cells_x), first(rect.y0, this->origin_y, nr_cells_y),
+            last(rect.x1, this->origin_x, nr_cells_x), last(rect.y1, this->origin_y, nr_cells_y) };
+    }
+
+    template<typename F>
+    constexpr void for_each_cell(Rect const& rect, F&& f) const {
+        Cells const cells = this->cells_of(rect);
+        for (std::size_t x = cells.x0; x < cells.x1; x++) {
+            for (std::size_t y = cells.y0; y < cells.y1; y++) {
+                f(x * nr_cells_y + y);
+            }
+        }
+    }
+
+public:
+    constexpr HeightMap(Length const origin_x, Length const origin_y, Length const cell_size, Length const floor)
+        :origin_x(origin_x), origin_y(origin_y), cell_size(cell_size), floor(floor), tops()
+    {
+        this->clear();
+    }
+
+    constexpr Rect area() const {
+        return Rect{ this->origin_x, this->origin_y,
+            this->origin_x + (std::int64_t)nr_cells_x * this->cell_size, this->origin_y + (std::int64_t)nr_cells_y * this->cell_size };
+    }
+
+    constexpr bool overlaps(Rect const& rect) const {
+        Rect const a = this->area();
+        return rect.x0 < a.x1 && a.x0 < rect.x1 && rect.y0 < a.y1 && a.y0 < rect.y1;
+    }
+
+    //rect completely on the map and on cell borders, as every box has to be
+    constexpr bool fits(Rect const& rect) const {
+        Rect const a = this->area();
+        return rect.x0 >= a.x0 && rect.y0 >= a.y0 && rect.x1 <= a.x1 && rect.y1 <= a.y1 &&
+            (rect.x0 - a.x0) % this->cell_size == Length() && (rect.y0 - a.y0) % this->cell_size == Length() &&
+            (rect.x1 - a.x0) % this->cell_size == Length() && (rect.y1 - a.y0) % this->cell_size == Length();
+    }
+
+    //smallest z of all cells under rect, the floor if rect is not on the map
+    constexpr Length highest_top(Rect const& rect) const {
+        Length top = Length::max();
+        this->for_each_cell(rect, [&](std::size_t const i) { top = std::min(top, this->tops[i]); });
+        return top == Length::max() ? this->floor : top;
+    }
+
+    //all cells under rect have the same top, thus something put on rect stands flat
+    constexpr bool is_flat(Rect const& rect) const {
+        Length const top = this->highest_top(rect);
+        bool flat = true;
+        this->for_each_cell(rect, [&](std::size_t const i) { flat = flat && this->tops[i] == top; });
+        return flat;
+    }
+
+    //puts something of height on rect, it rests on the highest cell below
+    constexpr void stack(Rect const& rect, Length const height) {
+        Length const top = this->highest_top(rect) - height;
+        this->for_each_cell(rect, [&](std::size_t const i) { this->tops[i] = top; });
+    }
+
+    constexpr void clear() { this->tops.fill(this->floor); }
+}; //class HeightMap
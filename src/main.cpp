@@ -5,54 +5,95 @@
 #include <chrono>
 #include <thread>
 #include <iostream>
+#include <limits>
+#include <cstdlib>
+#include <vector>
+#include <optional>
+#include <span>
+#include <string_view>
 
 #include "coro_support.hpp"
 #include "motors.hpp"
+#include "plant_groups.hpp"
 #include "timer.hpp"
 #include "settings.hpp"
+#include "trace.hpp"
+#include "replay.hpp"
+#include "shared_image.hpp"
+#include "fieldbus.hpp"
+#include "random.hpp"
+#include "sweep.hpp"
+#include "stats.hpp"
+#include "height_map.hpp"
+#include "units.hpp"
+
+using namespace units::literals;
 
 
 enum class Error {
     InvalidGripperPos,
     EmergencyStop,
     BoxCatchedOnConveyor,
+    AxisTimeout,
     //To be continued...
 
     COUNT
 };
 
-constinit Settings<Error> settings = {};
+//the state of the program is thread_local (as is the one of the scheduler and the process image),
+//thus a sweep can run several independent simulations at once, see run_sweep.
+//only the devices (Motor and Piston) are shared, they are nothing more than an index into the image.
+constinit thread_local Settings<Error> settings = {};
 
-struct Position { std::int64_t x, y, z; };
+//z grows downward: 0 is the highest position of the arm, floor_pos the surface of an empty palette
+struct Position { Length x, y, z; };
+//a position in the horizontal plane only, the height is given elsewhere
+struct XYPosition { Length x, y; };
 
-//only correct in x and y axes.
-constexpr auto update_x_y_positions(std::int64_t x1, std::int64_t x2, std::int64_t y1, std::int64_t y2) {
+constexpr auto update_x_y_positions(Length x1, Length x2, Length y1, Length y2) {
     return std::array{
-        Position{ x1, y1, -1000 },
-        Position{ x2, y1, -1000 },
-        Position{ x1, y2, -1000 },
-        Position{ x2, y2, -1000 }
+        XYPosition{ x1, y1 },
+        XYPosition{ x2, y1 },
+        XYPosition{ x1, y2 },
+        XYPosition{ x2, y2 }
     };
 }
 
 struct GripperPositionParameters {
-    std::array<Position, 4> x_y_positions = update_x_y_positions(250, 150, 300, 200);
-    Position wait_pos = Position{ 100, 100, 100 };
-    Position box_pickup_pos = Position{ 100, 100, 200 };
-    std::int64_t box_height = 30;
-    std::int64_t floor_pos = 300;
+    std::array<XYPosition, 4> x_y_positions = update_x_y_positions(250_mm, 150_mm, 300_mm, 200_mm);
+    Position wait_pos = Position{ 100_mm, 100_mm, 100_mm };
+    Position box_pickup_pos = Position{ 100_mm, 100_mm, 200_mm };
+    Length pickup_clearance = 40_mm; //the arm may wait this far above box_pickup_pos while a box arrives
+    Length box_height = 30_mm;
+    Length box_size = 100_mm; //in x and y, boxes are stacked side by side
+    Length floor_pos = 600_mm;
     std::int64_t boxes_per_palette = 48;
+    //the palette stations stand on either side of the pickup position, x_y_positions are relative to each of them
+    std::array<Position, 2> palette_offsets = { Position{ 0_mm, 0_mm, 0_mm }, Position{ -200_mm, 0_mm, 0_mm } };
+
+    //above box_pickup_pos by pickup_clearance
+    constexpr Position pickup_hover_pos() const {
+        return Position{ this->box_pickup_pos.x, this->box_pickup_pos.y, this->box_pickup_pos.z - this->pickup_clearance };
+    }
+
+    //where the box goes that is put on palette after nr_boxes others
+    constexpr Position stack_box_pos(std::size_t const palette, std::int64_t const nr_boxes) const {
+        Position const offset = this->palette_offsets[palette];
+        XYPosition const slot = this->x_y_positions[nr_boxes % 4];
+        return Position{ slot.x + offset.x, slot.y + offset.y, this->floor_pos + offset.z - (nr_boxes / 4) * this->box_height };
+    }
 };
 
-constinit auto positions = GripperPositionParameters{};
-constinit std::int64_t nr_boxes = 0;
+//the machine as built. everything derived from it is computed at compile time, see CycleModel.
+constexpr auto nominal_positions = GripperPositionParameters{};
+//the machine simulated by the current thread, only a sweep deviates from nominal_positions (see set_positions)
+constinit thread_local GripperPositionParameters positions = nominal_positions;
 
-Position next_stack_box_pos() {
-    Position pos = positions.x_y_positions[nr_boxes % 4];
-    pos.z = positions.floor_pos + (nr_boxes / 4) * positions.box_height;
-    return pos;
-}
+constexpr auto nominal_tick_period = std::chrono::milliseconds(10);
 
+//conveyor bringing the boxes to the pickup position.
+//boxes arriving while the pickup position is taken wait upstream in a queue of queue_slots boxes,
+//thus after a pickup the next box only needs to move up by one slot.
 struct Inlet {
     enum class State {
         Undefined,
@@ -61,22 +102,59 @@ struct Inlet {
         BoxReady,
         COUNT
     };
-    static inline constinit State state = State::Undefined;
+    static constexpr std::array<char const*, (std::size_t)State::COUNT> state_names = {
+        "Undefined", "NoBox", "MoveBox", "BoxReady" };
+    static inline constinit thread_local State state = State::Undefined;
+    static inline constinit thread_local std::uint64_t box_ready_tick = 0; //(expected) tick the current box is ready
+    static inline constinit thread_local std::size_t queue_slots = 3;
+    static inline constinit thread_local std::size_t nr_queued = 0; //boxes waiting upstream of the pickup position
+    enum class Arrivals {
+        Uniform,     //a new box enters at most every arrival_interval +- arrival_jitter
+        Exponential, //boxes come independent of each other, on average every arrival_interval (jitter unused)
+    };
+    static inline constinit thread_local Arrivals arrivals = Arrivals::Uniform;
+    static inline constinit thread_local std::chrono::milliseconds arrival_interval = std::chrono::milliseconds(100);
+    static inline constinit thread_local std::chrono::milliseconds arrival_jitter = std::chrono::milliseconds(0);
+    static inline constinit thread_local Random random = Random(0);
     static constexpr std::size_t coroutines_stack_size = 512;
     static constexpr auto name = "Inlet";
+    static constexpr auto advance_duration = std::chrono::milliseconds(30); //moving a box up by one slot
 
-    static SideEffectCoroutine<Inlet> run() {
-        assert(state == State::Undefined);
+    static std::chrono::milliseconds next_arrival_interval() {
+        if (arrivals == Arrivals::Exponential) {
+            return std::chrono::milliseconds(std::llround(random.exponential((double)arrival_interval.count())));
+        }
+        if (arrival_jitter.count() == 0) return arrival_interval;
+        return arrival_interval + std::chrono::milliseconds(random.uniform(-arrival_jitter.count(), arrival_jitter.count()));
+    }
+
+    //upstream end of the conveyor
+    static SideEffectCoroutine<Inlet> feed() {
         while (true) {
-            WAIT_WHILE(!settings.is_active());
+            WAIT_WHILE(!settings.is_active() || nr_queued >= queue_slots);
+            co_await delay(next_arrival_interval());
+            nr_queued++;
+        }
+    }
+
+    //moves the first waiting box to the pickup position and holds it there until the arm has taken it
+    static SideEffectCoroutine<Inlet> advance() {
+        while (true) {
+            state = State::NoBox;
+            WAIT_WHILE(!settings.is_active() || nr_queued == 0);
             state = State::MoveBox;
-            for (auto i = 0; i < 10; i++) {
-                YIELD;
-            }
+            nr_queued--;
+            box_ready_tick = Scheduler::after(Scheduler::to_ticks(advance_duration));
+            co_await WakeAt{ box_ready_tick };
             state = State::BoxReady;
             WAIT_WHILE(state == State::BoxReady);
         }
     }
+
+    static SideEffectCoroutine<Inlet> run() {
+        assert(state == State::Undefined);
+        EXEC_ALL(feed(), advance());
+    }
 }; //struct Inlet
 
 struct Mag {
@@ -87,26 +165,191 @@ struct Mag {
         Empty,
         COUNT
     };
-    static inline constinit State state = State::Undefined;
+    static constexpr std::array<char const*, (std::size_t)State::COUNT> state_names = {
+        "Undefined", "Ready", "Reloading", "Empty" };
+    //two palette stations: while a full palette is exchanged, the arm keeps stacking on the other one
+    static constexpr std::size_t nr_palettes = 2;
+    static inline constinit thread_local std::array<State, nr_palettes> states = { State::Undefined, State::Undefined };
+    static inline constinit thread_local std::array<std::int64_t, nr_palettes> nr_boxes = {};
+    static inline constinit thread_local std::size_t active = 0; //palette the arm stacks on
+    static inline constinit thread_local std::uint64_t nr_stacked = 0; //all boxes stacked since startup
     static constexpr std::size_t coroutines_stack_size = 512;
     static constexpr auto name = "Magazine";
+    static constexpr auto reload_duration = std::chrono::milliseconds(50);
 
-    static SideEffectCoroutine<Mag> run() {
-        assert(state == State::Undefined);
+    //the arm may stack on the active palette
+    static bool is_ready() { return states[active] == State::Ready; }
+
+    static SideEffectCoroutine<Mag> station(std::size_t const palette) {
         while (true) {
-            state = State::Ready;
-            WAIT_WHILE(nr_boxes < positions.boxes_per_palette);
-            state = State::Reloading;
-            nr_boxes = 0;
-            //TODO: simulate magazine (better then waiting for some time)
-            for (auto i = 0; i < 5; i++) {
-                YIELD;
+            states[palette] = State::Ready;
+            WAIT_WHILE(nr_boxes[palette] < positions.boxes_per_palette);
+            if (active == palette) {
+                active = (palette + 1) % nr_palettes;
             }
+            states[palette] = State::Reloading;
+            nr_boxes[palette] = 0;
+            //TODO: simulate magazine (better then waiting for some time)
+            co_await delay(reload_duration);
         }
     }
 
+    static SideEffectCoroutine<Mag> run() {
+        assert(states[0] == State::Undefined);
+        static_assert(nr_palettes == 2);
+        EXEC_ALL(station(0), station(1));
+    }
+
 }; //struct Mag
 
+static_assert(Mag::nr_palettes == trace_nr_palettes);
+static_assert(Mag::nr_palettes == std::tuple_size_v<decltype(GripperPositionParameters::palette_offsets)>);
+
+Position next_stack_box_pos() {
+    return positions.stack_box_pos(Mag::active, Mag::nr_boxes[Mag::active]);
+}
+
+constexpr Length traverse_clearance = 20_mm; //between the lowest point of the arm and whatever it moves over
+//boxes_per_palette is the same for all positions, thus the size of SafeHeights is known at compile time
+constexpr std::size_t max_layers = (std::size_t)(nominal_positions.boxes_per_palette + 3) / 4;
+
+//largest z the arm may move sideways at, derived from the positions.
+//the lowest point of the arm is z whether it carries a box or not: z is the bottom of a carried box,
+//the jaws of the empty gripper reach down as far.
+struct SafeHeights {
+    //above a palette, per palette and number of started layers on it
+    std::array<std::array<Length, max_layers + 1>, Mag::nr_palettes> above_palette = {};
+    //above the box waiting at the pickup position
+    Length above_pickup = {};
+
+    constexpr explicit SafeHeights(GripperPositionParameters const& p) {
+        for (std::size_t palette = 0; palette < Mag::nr_palettes; palette++) {
+            for (std::size_t layers = 0; layers <= max_layers; layers++) {
+                this->above_palette[palette][layers] = p.floor_pos + p.palette_offsets[palette].z
+                    - (std::int64_t)layers * p.box_height - traverse_clearance;
+            }
+        }
+        this->above_pickup = p.box_pickup_pos.z - p.box_height - traverse_clearance;
+    }
+}; //struct SafeHeights
+
+constexpr SafeHeights nominal_safe_heights = SafeHeights(nominal_positions);
+//per thread as positions, see set_positions
+constinit thread_local SafeHeights safe_heights = nominal_safe_heights;
+
+//nullptr if the program can work with p, otherwise why not
+constexpr char const* position_problem(GripperPositionParameters const& p) {
+    SafeHeights const heights(p);
+    if (p.boxes_per_palette != nominal_positions.boxes_per_palette) {
+        return "boxes_per_palette differs from nominal_positions";
+    }
+    //wait_pos stays reachable on a straight line (and homeing possible) with both palettes full
+    if (p.wait_pos.z > heights.above_pickup) {
+        return "wait_pos too low above the pickup position";
+    }
+    for (auto const& palette : heights.above_palette) {
+        if (p.wait_pos.z > palette[max_layers]) return "wait_pos too low above a full palette";
+    }
+    //the arm waits above the arriving box
+    if (p.pickup_clearance < p.box_height) {
+        return "pickup_clearance less than box_height";
+    }
+    return nullptr;
+}
+
+static_assert(!position_problem(nominal_positions));
+
+//a started layer counts as full
+std::size_t nr_started_layers(std::size_t const palette) {
+    return (std::size_t)(Mag::nr_boxes[palette] + 3) / 4;
+}
+
+//lowest safe height (largest z) to move sideways at from one position to another: above everything the path may cross,
+//i.e. the stacks on the palettes and the box waiting at the pickup position (see safe_heights).
+//x and y move at the same time, thus the path is approximated by the bounding box of the footprints at both ends.
+//the arm moves between a handful of positions only, thus planned heights are cached per pair of positions
+//(and stack heights, so a cached plan never gets stale).
+struct PathPlanner {
+    static constexpr Length nothing_in_the_way = Length::max();
+
+    struct Key {
+        Length from_x, from_y, to_x, to_y;
+        std::array<std::size_t, Mag::nr_palettes> nr_layers;
+        bool operator==(Key const&) const = default;
+    };
+    struct Entry {
+        Key key;
+        Length safe_z;
+        bool valid;
+    };
+    static inline constinit thread_local std::array<Entry, 16> cache = {};
+    static inline constinit thread_local std::uint64_t nr_planned = 0;
+    static inline constinit thread_local std::uint64_t nr_cached = 0;
+
+    static constexpr Length plan(GripperPositionParameters const& p, SafeHeights const& heights,
+        Position const& from, Position const& to, std::array<std::size_t, Mag::nr_palettes> const& nr_layers)
+    {
+        Rect const a = Rect::centered(from.x, from.y, p.box_size);
+        Rect const b = Rect::centered(to.x, to.y, p.box_size);
+        Rect const path = { std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1) };
+        auto const crosses = [&](Rect const& r) {
+            return path.x0 < r.x1 && r.x0 < path.x1 && path.y0 < r.y1 && r.y0 < path.y1;
+        };
+
+        Length safe_z = nothing_in_the_way;
+        Position const pickup = p.box_pickup_pos;
+        if (crosses(Rect::centered(pickup.x, pickup.y, p.box_size))) {
+            safe_z = heights.above_pickup;
+        }
+        for (std::size_t palette = 0; palette < Mag::nr_palettes; palette++) {
+            Position const offset = p.palette_offsets[palette];
+            for (XYPosition const& slot : p.x_y_positions) {
+                if (crosses(Rect::centered(slot.x + offset.x, slot.y + offset.y, p.box_size))) {
+                    safe_z = std::min(safe_z, heights.above_palette[palette][nr_layers[palette]]);
+                }
+            }
+        }
+        return safe_z;
+    }
+
+    //largest z the arm may move sideways at from from to to
+    static Length safe_traverse_z(Position const& from, Position const& to) {
+        Key key = { from.x, from.y, to.x, to.y, {} };
+        std::uint64_t hash = 0;
+        for (Length const v : { from.x, from.y, to.x, to.y }) {
+            hash = (hash ^ (std::uint64_t)v.count()) * 0x100000001b3;
+        }
+        for (std::size_t palette = 0; palette < Mag::nr_palettes; palette++) {
+            key.nr_layers[palette] = nr_started_layers(palette);
+            hash = (hash ^ (std::uint64_t)key.nr_layers[palette]) * 0x100000001b3;
+        }
+        Entry& entry = cache[(hash >> 32) % cache.size()];
+        nr_planned++;
+        if (entry.valid && entry.key == key) {
+            nr_cached++;
+            return entry.safe_z;
+        }
+        entry = Entry{ key, plan(positions, safe_heights, from, to, key.nr_layers), true };
+        return entry.safe_z;
+    }
+
+    //the positions changed, see set_positions
+    static void clear_cache() { cache = {}; }
+
+    static void print_stats(std::ostream& out) {
+        out << "path planner: " << nr_planned << " traverses planned, " << nr_cached << " from cache ("
+            << (nr_planned ? 100 * nr_cached / nr_planned : 0) << "%)\n";
+    }
+}; //struct PathPlanner
+
+//the current thread simulates a machine built as p from now on. p has to be usable, see position_problem.
+void set_positions(GripperPositionParameters const& p) {
+    assert(!position_problem(p));
+    positions = p;
+    safe_heights = SafeHeights(p);
+    PathPlanner::clear_cache();
+}
+
 
 struct Arm {
     enum class State {
@@ -115,32 +358,138 @@ struct Arm {
         InHomePos,
         ToWaitPos,
         Waiting,
+        PrePositioning,
         TakeBox,
         TransportBox,
         ReleaseBox,
         COUNT
     };
-    static inline constinit State state = State::Undefined;
-    static constexpr std::size_t coroutines_stack_size = 512;
+    static constexpr std::array<char const*, (std::size_t)State::COUNT> state_names = {
+        "Undefined", "Homeing", "InHomePos", "ToWaitPos", "Waiting", "PrePositioning", "TakeBox", "TransportBox", "ReleaseBox" };
+    static inline constinit thread_local State state = State::Undefined;
+    static constexpr std::size_t coroutines_stack_size = 1024;
+    static constexpr std::array coroutines_sub_stacks = { "Arm", "Arm parallel" };
     static constexpr auto name = "Arm";
+    static constexpr auto move_timeout = std::chrono::seconds(2); //no move may take longer
+    //gives up waiting above the pickup position, if the box is this late
+    static constexpr auto preposition_grace = std::chrono::milliseconds(200);
+    //duration of the last move from wait_pos to above the pickup position.
+    //the arm starts moving this long before the box is expected to be ready.
+    static inline constinit thread_local Ticks preposition_ticks = {};
+    //the gripper was told to close on a box and not yet to open again. survives an error, see homeing.
+    static inline constinit thread_local bool holds_box = false;
+
+    //global variables, shared by all threads
+    static inline Motor x_axis = {};
+    static inline Motor y_axis = {};
+    static inline Motor z_axis = {};
+    static inline Piston gripper = {};
+
+    //sets Error::AxisTimeout if the axis does not reach its target in time
+    //stops the axis if cancelled
+    static SideEffectCoroutine<Arm> move_axis(Motor& axis, Length const target) {
+        ON_CANCEL(axis.stop());
+        bool timed_out = false;
+        axis.go_to_pos(target);
+        WAIT_WHILE_FOR(axis.is_moving(), move_timeout, timed_out);
+        if (timed_out) {
+            settings.set_error(Error::AxisTimeout);
+        }
+    }
+
+    //an action may only start while all of its interlocks hold, otherwise it waits
+    struct Interlock {
+        char const* name;
+        bool (*holds)(Position const& target);
+    };
 
-    //global variables
-    static inline SimulatedMotor x_axis = {};
-    static inline SimulatedMotor y_axis = {};
-    static inline SimulatedMotor z_axis = {};
-    static inline SimulatedPiston gripper = {};
+    //the gripper starts to close (or open) while z is still up to gripper_lead away from its target, but only as far as
+    //z travels (at the speed seen in the last scan) during gripper_change_ticks. thus the gripper never closes before
+    //the box is reached, whatever the speed of z.
+    static constexpr Length gripper_lead = 30_mm;
+    static constexpr Ticks gripper_change_ticks = 3_ticks; //the fastest the gripper closes (or opens)
+    static inline constinit thread_local Speed z_speed = {}; //during the last scan, see actuate_gripper
 
-    //moves first vertical to initial_z, then to x and y, then to z
-    static SideEffectCoroutine<Arm> go_to(std::int64_t const initial_z, Position const pos) {
-        z_axis.go_to_pos(initial_z);
-        WAIT_WHILE(z_axis.is_moving());
+    static_assert(gripper_change_ticks <= Ticks(SimulatedPiston::change_ticks));
+    //the whole lead is used at nominal speed, as CycleModel assumes
+    static_assert(SimulatedMotor::nominal_speed * gripper_change_ticks >= gripper_lead);
 
-        x_axis.go_to_pos(pos.x);
-        y_axis.go_to_pos(pos.y);
-        WAIT_WHILE(x_axis.is_moving() || y_axis.is_moving());
+    static constexpr std::array gripper_interlocks = {
+        Interlock{ "x and y at target", [](Position const& target) {
+            return x_axis.pos() == target.x && y_axis.pos() == target.y; } },
+        Interlock{ "z reaches target before the gripper has moved", [](Position const& target) {
+            return abs(z_axis.pos() - target.z) <= std::min(gripper_lead, z_speed * gripper_change_ticks); } },
+    };
+    static constexpr std::array lift_interlocks = {
+        Interlock{ "gripper not moving", [](Position const&) { return !gripper.is_moving(); } },
+    };
 
-        z_axis.go_to_pos(pos.z);
-        WAIT_WHILE(z_axis.is_moving());
+    static bool all_hold(std::span<Interlock const> const interlocks, Position const& target) {
+        return std::all_of(interlocks.begin(), interlocks.end(), [&](Interlock const& i) { return i.holds(target); });
+    }
+
+    //height to move sideways at from the current position to pos: the current one, unless that is too low for the path
+    static Length traverse_z(Position const& pos) {
+        Position const from = { x_axis.pos(), y_axis.pos(), z_axis.pos() };
+        return std::min(from.z, PathPlanner::safe_traverse_z(from, pos));
+    }
+
+    //moves first vertical to initial_z, then to x and y (both at once) of pos
+    static SideEffectCoroutine<Arm> approach(Length const initial_z, Position const pos) {
+        WAIT_WHILE(!all_hold(lift_interlocks, pos));
+        EXEC(move_axis(z_axis, initial_z));
+        EXEC_ALL(move_axis(x_axis, pos.x), move_axis(y_axis, pos.y));
+    }
+
+    //moves to pos as approach does, then down to pos.z
+    static SideEffectCoroutine<Arm> go_to(Length const initial_z, Position const pos) {
+        EXEC(approach(initial_z, pos));
+        EXEC(move_axis(z_axis, pos.z));
+    }
+
+    //closes (grip = true) or opens the gripper as soon as its interlocks hold for target
+    static SideEffectCoroutine<Arm> actuate_gripper(Position const target, bool const grip) {
+        z_speed = {};
+        Length prev_z = z_axis.pos();
+        while (!all_hold(gripper_interlocks, target)) {
+            YIELD;
+            z_speed = abs(z_axis.pos() - prev_z) / 1_ticks;
+            prev_z = z_axis.pos();
+        }
+        if (grip) {
+            gripper.retract();
+        }
+        else {
+            gripper.extend();
+        }
+        holds_box = grip;
+        //z is stopped on an error, a gripper closing before z has reached the box closes above it
+        ON_CANCEL(if (grip && z_axis.pos() != target.z) holds_box = false);
+        WAIT_WHILE(gripper.is_moving());
+    }
+
+    //as go_to, but the gripper already moves during the last gripper_lead of the descent
+    static SideEffectCoroutine<Arm> go_to_and_actuate_gripper(Length const initial_z, Position const pos, bool const grip) {
+        EXEC(approach(initial_z, pos));
+        EXEC_ALL(move_axis(z_axis, pos.z), actuate_gripper(pos, grip));
+    }
+
+    //carries the box in the gripper to the next place on the active palette and puts it down there
+    static SideEffectCoroutine<Arm> put_down_box() {
+        assert(holds_box && Mag::is_ready());
+        state = State::TransportBox;
+        std::size_t const palette = Mag::active;
+        Position const stack_pos = next_stack_box_pos();
+        EXEC(approach(traverse_z(stack_pos), stack_pos));
+
+        state = State::ReleaseBox;
+        {
+            //once the gripper opens, the box stands on the stack, even if an error stops the arm right after
+            ON_CANCEL(if (!holds_box) { Mag::nr_boxes[palette]++; Mag::nr_stacked++; });
+            EXEC_ALL(move_axis(z_axis, stack_pos.z), actuate_gripper(stack_pos, false));
+        }
+        Mag::nr_boxes[palette]++;
+        Mag::nr_stacked++;
     }
 
     static SideEffectCoroutine<Arm> box_stacking_cycle() {
@@ -150,33 +499,51 @@ struct Arm {
             gripper.is_extended());
 
         state = State::ToWaitPos;
-        EXEC(go_to(100, positions.wait_pos));
+        EXEC(go_to(traverse_z(positions.wait_pos), positions.wait_pos));
 
         state = State::Waiting;
-        do {
+        //start moving to the box early enough to arrive just when it is ready
+        while (!Mag::is_ready() || (Inlet::state != Inlet::State::BoxReady &&
+            (Inlet::state != Inlet::State::MoveBox || Scheduler::until(Inlet::box_ready_tick) > preposition_ticks)))
+        {
             if (!settings.is_active()) {
                 co_return;
             }
             YIELD;
-        } while (Inlet::state != Inlet::State::BoxReady || Mag::state != Mag::State::Ready);
+        }
+
+        state = State::PrePositioning;
+        Position const hover_pos = positions.pickup_hover_pos();
+        std::uint64_t const start_tick = Scheduler::now();
+        EXEC(go_to(traverse_z(hover_pos), hover_pos));
+        preposition_ticks = Scheduler::since(start_tick);
+        {
+            //abort path: the box did not come as announced (or the machine was stopped), back to wait_pos
+            Timeout const too_late(preposition_grace + Scheduler::to_duration(Scheduler::until(Inlet::box_ready_tick)));
+            while (Inlet::state != Inlet::State::BoxReady || !Mag::is_ready()) {
+                if (!settings.is_active() || too_late.expired()) {
+                    state = State::ToWaitPos;
+                    EXEC(go_to(traverse_z(positions.wait_pos), positions.wait_pos));
+                    state = State::Waiting;
+                    co_return;
+                }
+                YIELD;
+            }
+        }
 
         state = State::TakeBox;
         assert(gripper.is_extended());
-        EXEC(go_to(100, positions.box_pickup_pos));
-        gripper.retract();
-        WAIT_WHILE(!gripper.is_retracted());
+        {
+            //once the gripper closes, the box has left the inlet, even if an error stops the arm right after
+            ON_CANCEL(if (holds_box) Inlet::state = Inlet::State::NoBox);
+            EXEC(go_to_and_actuate_gripper(hover_pos.z, positions.box_pickup_pos, true));
+        }
         Inlet::state = Inlet::State::NoBox;
 
-        state = State::TransportBox;
-        EXEC(go_to(100, next_stack_box_pos()));
-
-        state = State::ReleaseBox;
-        gripper.extend();
-        WAIT_WHILE(!gripper.is_extended());
-        nr_boxes++;
+        EXEC(put_down_box());
 
         state = State::ToWaitPos;
-        EXEC(go_to(100, positions.wait_pos));
+        EXEC(go_to(traverse_z(positions.wait_pos), positions.wait_pos));
 
         state = State::Waiting;
     }
@@ -185,7 +552,16 @@ struct Arm {
         assert(state == State::Homeing);
         //this is obv. not how homeing works in practice
         //TODO: include sensors
-        EXEC(go_to(0, Position{ 0, 0, 0 }));
+        //a box still held after an error is put where the cycle would have put it, thus the stacks stay as Mag counts them.
+        //it is only let go once the gripper has closed completely.
+        if (holds_box) {
+            WAIT_WHILE(gripper.is_moving() || !Mag::is_ready());
+            EXEC(put_down_box());
+            state = State::Homeing;
+        }
+        gripper.extend();
+        WAIT_WHILE(gripper.is_moving());
+        EXEC(go_to(0_mm, Position{ 0_mm, 0_mm, 0_mm }));
         state = State::InHomePos;
     }
 
@@ -195,7 +571,7 @@ struct Arm {
 
             WAIT_WHILE(settings.has_error());
             state = State::Homeing;
-            EXEC_WHILE(!settings.has_error(), homeing());
+            EXEC_UNTIL_CANCELLED(settings.error_token(), homeing());
 
             while (!settings.has_error()) { //box transport cycle
                 while (!settings.is_active()) {
@@ -203,7 +579,7 @@ struct Arm {
                     YIELD;
                 }
                 while (settings.is_active()) {
-                    EXEC_WHILE(!settings.has_error(), box_stacking_cycle());
+                    EXEC_UNTIL_CANCELLED(settings.error_token(), box_stacking_cycle());
                 }
             }
             //if an error eccurs, the program jumps here
@@ -215,6 +591,218 @@ struct Arm {
     } //run
 }; //struct Arm
 
+//ideal duration of box_stacking_cycle from the nominal geometry and speeds alone: every move takes exactly the
+//ticks its distance needs at SimulatedMotor::nominal_speed, the next move starts right away and the box is always
+//ready when the arm is (as with a full inlet queue). follows the cycle move by move (with the same traverse heights),
+//thus it is a lower bound of the measured cycle time: the program needs about one more tick per move to see it done.
+//the other palette is assumed empty, as it is while exchanged.
+struct CycleModel {
+    struct Motion {
+        Position pos;
+        Ticks ticks;
+        Ticks longest_move; //of a single axis
+    };
+    using Layers = std::array<std::size_t, Mag::nr_palettes>;
+
+    static constexpr Ticks move_ticks(Motion& m, Length const from, Length const to) {
+        Ticks const ticks = ticks_to_cover(abs(to - from), SimulatedMotor::nominal_speed);
+        m.longest_move = std::max(m.longest_move, ticks);
+        return ticks;
+    }
+
+    //as Arm::approach
+    static constexpr void approach(Motion& m, Length const initial_z, Position const& target) {
+        m.ticks += move_ticks(m, m.pos.z, initial_z) +
+            std::max(move_ticks(m, m.pos.x, target.x), move_ticks(m, m.pos.y, target.y));
+        m.pos = Position{ target.x, target.y, initial_z };
+    }
+
+    //as Arm::approach with Arm::traverse_z
+    static constexpr void approach(Motion& m, Position const& target, Layers const& nr_layers) {
+        approach(m, std::min(m.pos.z, PathPlanner::plan(nominal_positions, nominal_safe_heights, m.pos, target, nr_layers)), target);
+    }
+
+    static constexpr void go_to(Motion& m, Position const& target, Layers const& nr_layers) {
+        approach(m, target, nr_layers);
+        m.ticks += move_ticks(m, m.pos.z, target.z);
+        m.pos.z = target.z;
+    }
+
+    //the gripper starts within Arm::gripper_lead of z, see Arm::go_to_and_actuate_gripper
+    static constexpr void descend_and_actuate_gripper(Motion& m, Length const z) {
+        Length const distance = abs(z - m.pos.z);
+        Ticks const gripper_start = distance > Arm::gripper_lead
+            ? ticks_to_cover(distance - Arm::gripper_lead, SimulatedMotor::nominal_speed) : 0_ticks;
+        m.ticks += std::max(move_ticks(m, m.pos.z, z), gripper_start + Ticks(SimulatedPiston::change_ticks));
+        m.pos.z = z;
+    }
+
+    //from wait_pos back to wait_pos, putting the box on palette after nr_boxes others
+    static constexpr Motion box_cycle(std::size_t const palette, std::int64_t const nr_boxes) {
+        Layers nr_layers = {};
+        nr_layers[palette] = (std::size_t)(nr_boxes + 3) / 4;
+        Position const hover_pos = nominal_positions.pickup_hover_pos();
+        Motion m = { nominal_positions.wait_pos, 0_ticks, 0_ticks };
+        go_to(m, hover_pos, nr_layers);
+        approach(m, hover_pos.z, nominal_positions.box_pickup_pos); //straight down, no traverse height
+        descend_and_actuate_gripper(m, nominal_positions.box_pickup_pos.z);
+        Position const stack_pos = nominal_positions.stack_box_pos(palette, nr_boxes);
+        approach(m, stack_pos, nr_layers);
+        descend_and_actuate_gripper(m, stack_pos.z);
+        nr_layers[palette] = (std::size_t)(nr_boxes + 4) / 4;
+        go_to(m, nominal_positions.wait_pos, nr_layers);
+        return m;
+    }
+
+    static constexpr Ticks box_ticks(std::size_t const palette, std::int64_t const nr_boxes) {
+        return box_cycle(palette, nr_boxes).ticks;
+    }
+
+    static constexpr Ticks layer_ticks(std::size_t const palette, std::int64_t const layer) {
+        Ticks ticks = {};
+        for (std::int64_t box = 4 * layer; box < 4 * layer + 4; box++) {
+            ticks += box_ticks(palette, box);
+        }
+        return ticks;
+    }
+
+    static constexpr Ticks palette_ticks(std::size_t const palette) {
+        Ticks ticks = {};
+        for (std::int64_t layer = 0; layer < (std::int64_t)max_layers; layer++) {
+            ticks += layer_ticks(palette, layer);
+        }
+        return ticks;
+    }
+
+    static constexpr Ticks longest_move_ticks() {
+        Ticks longest = {};
+        for (std::size_t palette = 0; palette < Mag::nr_palettes; palette++) {
+            for (std::int64_t box = 0; box < nominal_positions.boxes_per_palette; box++) {
+                longest = std::max(longest, box_cycle(palette, box).longest_move);
+            }
+        }
+        return longest;
+    }
+
+    static constexpr std::int64_t boxes_per_hour(std::size_t const palette) {
+        constexpr Ticks ticks_per_hour = Ticks(std::chrono::hours(1) / nominal_tick_period);
+        return nominal_positions.boxes_per_palette * ticks_per_hour / palette_ticks(palette);
+    }
+
+    static void print(std::ostream& out) {
+        for (std::size_t palette = 0; palette < Mag::nr_palettes; palette++) {
+            std::chrono::duration<double, std::milli> const per_box =
+                nominal_tick_period * palette_ticks(palette).count() / (double)nominal_positions.boxes_per_palette;
+            out << "cycle model, palette " << palette << ": ideal " << per_box.count() << "ms per box (first layer "
+                << layer_ticks(palette, 0).count() * nominal_tick_period.count() / 4 << "ms, last layer "
+                << layer_ticks(palette, max_layers - 1).count() * nominal_tick_period.count() / 4 << "ms), "
+                << boxes_per_hour(palette) << " boxes per hour\n";
+        }
+    }
+}; //struct CycleModel
+
+//parameter sets which can not work (or are too slow) fail the build
+static_assert(CycleModel::longest_move_ticks().count() * nominal_tick_period < Arm::move_timeout,
+    "a move takes longer than Arm::move_timeout even at nominal speed");
+constexpr std::int64_t target_boxes_per_hour = 5000;
+static_assert(CycleModel::boxes_per_hour(0) >= target_boxes_per_hour && CycleModel::boxes_per_hour(1) >= target_boxes_per_hour,
+    "the arm can not reach target_boxes_per_hour with these positions");
+
+
+//where the boxes really are, as far as the simulated devices tell: the stacks on the palettes as height maps,
+//plus the box in the gripper. a box is taken when the gripper closes at the pickup position (closing above it misses
+//the box) and stands where the gripper opens. counts boxes not standing properly on a palette, and collisions of the
+//arm with a stack.
+//the palette exchange is not simulated (see Mag), a palette is emptied as soon as it is full.
+class StackModel {
+    static constexpr Length cell_size = 50_mm;
+    using PaletteMap = HeightMap<4, 4>;
+
+    static PaletteMap make_palette_map(Position const& offset) {
+        Length min_x = Length::max();
+        Length min_y = Length::max();
+        for (XYPosition const& pos : positions.x_y_positions) {
+            min_x = std::min(min_x, pos.x);
+            min_y = std::min(min_y, pos.y);
+        }
+        return PaletteMap(offset.x + min_x - positions.box_size / 2, offset.y + min_y - positions.box_size / 2,
+            cell_size, positions.floor_pos + offset.z);
+    }
+
+    std::array<PaletteMap, Mag::nr_palettes> palettes = {
+        make_palette_map(positions.palette_offsets[0]), make_palette_map(positions.palette_offsets[1]) };
+    std::array<std::int64_t, Mag::nr_palettes> nr_boxes = {};
+    bool holding = false;
+    bool was_closed = false;
+    bool colliding = false;
+
+public:
+    std::uint64_t nr_placed = 0;
+    std::uint64_t nr_misplaced = 0;  //not flat, not completely on a palette or let go above it
+    std::uint64_t nr_collisions = 0; //counted once per contact, not per tick
+    std::uint64_t nr_missed = 0;     //gripper closed above the box instead of around it
+
+    //once per tick, after the devices were simulated
+    void update(Position const& arm, bool const gripper_closed, bool const gripper_open) {
+        Rect const footprint = Rect::centered(arm.x, arm.y, positions.box_size);
+        bool const just_closed = gripper_closed && !this->was_closed;
+        this->was_closed = gripper_closed;
+        if (!this->holding && just_closed && arm.x == positions.box_pickup_pos.x && arm.y == positions.box_pickup_pos.y) {
+            this->holding = arm.z == positions.box_pickup_pos.z;
+            this->nr_missed += !this->holding;
+        }
+        else if (this->holding && gripper_open) {
+            this->holding = false;
+            this->place(footprint, arm.z);
+        }
+
+        //the open gripper may enclose one box (the one just put down), jaws moving sideways through a box are not detected
+        Length const lowest = this->holding ? arm.z : arm.z - positions.box_height;
+        bool const colliding_now = std::any_of(this->palettes.begin(), this->palettes.end(), [&](PaletteMap const& map) {
+            return map.overlaps(footprint) && lowest > map.highest_top(footprint); });
+        this->nr_collisions += colliding_now && !this->colliding;
+        this->colliding = colliding_now;
+    }
+
+    void print(std::ostream& out) const {
+        out << "stacks: " << this->nr_placed << " boxes put down, " << this->nr_misplaced << " misplaced, "
+            << this->nr_collisions << " collisions, " << this->nr_missed << " missed\n";
+    }
+
+private:
+    //bottom is the z of the bottom of the box
+    void place(Rect const& footprint, Length const bottom) {
+        this->nr_placed++;
+        for (std::size_t i = 0; i < this->palettes.size(); i++) {
+            PaletteMap& map = this->palettes[i];
+            if (!map.overlaps(footprint)) continue;
+            this->nr_misplaced += !map.fits(footprint) || !map.is_flat(footprint) || bottom < map.highest_top(footprint);
+            map.stack(footprint, positions.box_height);
+            if (++this->nr_boxes[i] == positions.boxes_per_palette) {
+                map.clear();
+                this->nr_boxes[i] = 0;
+            }
+            return;
+        }
+        this->nr_misplaced++; //beside the palettes
+    }
+}; //class StackModel
+
+//simulation of the devices behind the process image (and of what they do to the boxes), one per thread simulating
+struct Plant {
+    SimulatedMotor x_axis = { Arm::x_axis };
+    SimulatedMotor y_axis = { Arm::y_axis };
+    SimulatedMotor z_axis = { Arm::z_axis };
+    SimulatedPiston gripper = { Arm::gripper };
+    StackModel stacks = {};
+
+    //after the devices were simulated for the tick
+    void update_stacks() {
+        this->stacks.update(Position{ this->x_axis.pos(), this->y_axis.pos(), this->z_axis.pos() },
+            this->gripper.is_retracted(), this->gripper.is_extended());
+    }
+}; //struct Plant
+
 void debug_print(std::chrono::nanoseconds const sleep_time) {
     char const* gripper = "??";
     if (Arm::gripper.is_moving()) gripper = "move";
@@ -229,7 +817,7 @@ void debug_print(std::chrono::nanoseconds const sleep_time) {
         << ", y: " << motor_state(Arm::y_axis)
         << ", z: " << motor_state(Arm::z_axis)
         << "] ";
-    std::cout << "box nr: " << nr_boxes;
+    std::cout << "box nr: " << Mag::nr_boxes[0] << " / " << Mag::nr_boxes[1];
 
     using namespace std::chrono_literals;
     std::chrono::duration<double, std::milli> const as_millis = sleep_time;
@@ -241,23 +829,499 @@ void debug_print(std::chrono::nanoseconds const sleep_time) {
     }
 }
 
+static_assert((std::size_t)Error::COUNT <= 32); //TraceRecord::error_bits
 
-int main() {
-    settings.set_active();
+TraceRecord make_trace_record(std::uint64_t const tick, std::chrono::nanoseconds const tick_start, std::chrono::nanoseconds const sleep_time) {
+    TraceGripper gripper = TraceGripper::Moving;
+    if (Arm::gripper.is_extended()) gripper = TraceGripper::Extended;
+    if (Arm::gripper.is_retracted()) gripper = TraceGripper::Retracted;
+
+    return TraceRecord{
+        .tick = tick,
+        .start_ns = tick_start.count(),
+        .slack_ns = sleep_time.count(),
+        .x = Arm::x_axis.pos().count(),
+        .y = Arm::y_axis.pos().count(),
+        .z = Arm::z_axis.pos().count(),
+        .error_bits = (std::uint32_t)settings.error_bits(),
+        .nr_boxes = { (std::uint16_t)Mag::nr_boxes[0], (std::uint16_t)Mag::nr_boxes[1] },
+        .mag_state = { (std::uint8_t)Mag::states[0], (std::uint8_t)Mag::states[1] },
+        .active_palette = (std::uint8_t)Mag::active,
+        .gripper = (std::uint8_t)gripper,
+        .arm_state = (std::uint8_t)Arm::state,
+        .inlet_state = (std::uint8_t)Inlet::state,
+        .inlet_queue = (std::uint8_t)Inlet::nr_queued,
+        .reserved = 0,
+    };
+}
 
-    auto arm_update = Arm::run();
-    auto mag_update = Mag::run();
-    auto inl_update = Inlet::run();
+//all consumers of the state reached at the end of each tick, apart from debug_print
+struct TickReport {
+    std::optional<TraceWriter> trace;
+    std::optional<ImagePublisher> image;
 
-    using namespace std::chrono_literals;
-    auto timer = Tick(10ms);
+    bool is_enabled() const { return this->trace || this->image; }
+
+    void report(TraceRecord const& record) {
+        if (this->trace) this->trace->write(record);
+        if (this->image) this->image->publish(record);
+    }
+}; //struct TickReport
+
+//polls the image published by another process and prints every tick it sees
+int watch_image(char const* const name) {
+    ImageReader const reader(name);
+    if (!reader) {
+        std::cerr << "no image published as " << name << "\n";
+        return 1;
+    }
+    constexpr std::array<char const*, (std::size_t)TraceGripper::COUNT> gripper_names = { "move", "open", "clse" };
+    std::uint64_t last_tick = std::numeric_limits<std::uint64_t>::max();
     while (true) {
-        arm_update();
-        mag_update();
-        inl_update(); 
+        TraceRecord rec;
+        if (reader.read(rec) && rec.tick != last_tick) {
+            last_tick = rec.tick;
+            std::cout << "tick " << rec.tick
+                << " [gripper: " << gripper_names[rec.gripper % gripper_names.size()]
+                << ", x: " << rec.x / 1000.0 << ", y: " << rec.y / 1000.0 << ", z: " << rec.z / 1000.0 << "] "
+                << "arm: " << Arm::state_names[rec.arm_state % Arm::state_names.size()]
+                << ", magazine: " << Mag::state_names[rec.mag_state[0] % Mag::state_names.size()]
+                << " / " << Mag::state_names[rec.mag_state[1] % Mag::state_names.size()]
+                << " (active " << (int)rec.active_palette << ")"
+                << ", inlet: " << Inlet::state_names[rec.inlet_state % Inlet::state_names.size()]
+                << " (" << (int)rec.inlet_queue << " queued)"
+                << ", box nr: " << rec.nr_boxes[0] << " / " << rec.nr_boxes[1]
+                << ", errors: " << rec.error_bits << std::endl;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+//everything a scan reads, but does not write itself: the settings (changed from outside, e.g. per HMI)
+//and the input image. one slot per device, as devices change independently.
+InputLayout scan_input_layout() {
+    InputLayout layout;
+    layout.add_slot<Settings<Error>::Snapshot>();
+    for (std::size_t i = 0; i < ProcessImage::motor_count(); i++) {
+        layout.add_slot<MotorInputs>();
+    }
+    for (std::size_t i = 0; i < ProcessImage::piston_count(); i++) {
+        layout.add_slot<PistonInputs>();
+    }
+    return layout;
+}
+
+void capture_scan_inputs(std::span<std::byte> image) {
+    InputImage const& field = ProcessImage::field_input_image();
+    store_slot(image, settings.snapshot());
+    for (std::size_t i = 0; i < ProcessImage::motor_count(); i++) {
+        store_slot(image, field.motors[i]);
+    }
+    for (std::size_t i = 0; i < ProcessImage::piston_count(); i++) {
+        store_slot(image, field.pistons[i]);
+    }
+}
+
+void apply_scan_inputs(std::span<std::byte const> image) {
+    InputImage& field = ProcessImage::field_input_image();
+    Settings<Error>::Snapshot snap;
+    load_slot(image, snap);
+    settings.restore(snap);
+    for (std::size_t i = 0; i < ProcessImage::motor_count(); i++) {
+        load_slot(image, field.motors[i]);
+    }
+    for (std::size_t i = 0; i < ProcessImage::piston_count(); i++) {
+        load_slot(image, field.pistons[i]);
+    }
+}
+
+void print_frame_stats(std::ostream& out) {
+    FramePool<Arm>::print_stats(out);
+    FramePool<Mag>::print_stats(out);
+    FramePool<Inlet>::print_stats(out);
+    PathPlanner::print_stats(out);
+}
+
+//the independent parts of the program, each executed once per scan (unless sleeping)
+struct Program {
+    SideEffectCoroutine<Arm> arm = Arm::run();
+    SideEffectCoroutine<Mag> mag = Mag::run();
+    SideEffectCoroutine<Inlet> inlet = Inlet::run();
+
+    Program() {
+        Scheduler::spawn(this->arm.handle);
+        Scheduler::spawn(this->mag.handle);
+        Scheduler::spawn(this->inlet.handle);
+    }
+
+    ~Program() { Scheduler::clear(); }
+
+    void scan() {
+        ProcessImage::latch_inputs();
+        Scheduler::run_tick();
+        ProcessImage::flush_outputs();
+    }
+}; //struct Program
+
+//runs the program in virtual time with the input image of every scan taken from a recording, not from the simulation.
+//as the program itself is deterministic, this reproduces the recorded run exactly.
+int replay(char const* const path, TickReport& report, std::chrono::nanoseconds const tick_period) {
+    InputReplayer replayer(path, scan_input_layout());
+    if (!replayer) {
+        std::cerr << "unable to replay " << path << "\n";
+        return 1;
+    }
+    Program program;
+    std::uint64_t tick = 0;
+    for (; replayer.has_more(); tick++) {
+        apply_scan_inputs(replayer.inputs_at(tick));
+        program.scan();
+        if (report.is_enabled()) {
+            report.report(make_trace_record(tick, tick * tick_period, tick_period));
+        }
+    }
+    std::cout << "replayed " << tick << " ticks, box nr: " << Mag::nr_boxes[0] << " / " << Mag::nr_boxes[1]
+        << ", arm: " << Arm::state_names[(std::size_t)Arm::state]
+        << ", magazine: " << Mag::state_names[(std::size_t)Mag::states[0]]
+        << " / " << Mag::state_names[(std::size_t)Mag::states[1]]
+        << ", inlet: " << Inlet::state_names[(std::size_t)Inlet::state] << "\n";
+    print_frame_stats(std::cout);
+    return 0;
+}
+
+//raises errors from outside the program (as a jammed box or an emergency stop would) at exponentially distributed
+//intervals, and acknowledges every error after recovery_ticks (as an operator would), then restarts the machine.
+//only draws once per raised error, not once per tick.
+class ErrorInjection {
+    static constexpr std::array injected = { Error::BoxCatchedOnConveyor, Error::EmergencyStop };
+    static constexpr std::uint64_t never = std::numeric_limits<std::uint64_t>::max();
+
+    Random random;
+    double mean_interval_ticks;
+    Ticks recovery_ticks;
+    std::uint64_t next_error_tick = never;
+    std::uint64_t acknowledge_tick = never;
+
+    std::uint64_t draw_next_error(std::uint64_t const tick) {
+        return tick + 1 + (std::uint64_t)this->random.exponential(this->mean_interval_ticks);
+    }
+
+public:
+    //mean_interval_ticks == 0: no errors are raised, but errors of the program itself are still acknowledged
+    ErrorInjection(double const mean_interval_ticks, Ticks const recovery_ticks, std::uint64_t const seed)
+        :random(seed), mean_interval_ticks(mean_interval_ticks), recovery_ticks(recovery_ticks)
+    {
+        if (mean_interval_ticks > 0) {
+            this->next_error_tick = this->draw_next_error(0);
+        }
+    }
+
+    //before the scan of tick
+    void tick(std::uint64_t const tick) {
+        if (tick >= this->next_error_tick) {
+            settings.set_error(injected[this->random.uniform(0, injected.size() - 1)]);
+            this->next_error_tick = this->draw_next_error(tick);
+        }
+        if (settings.has_error() && this->acknowledge_tick == never) {
+            this->acknowledge_tick = tick + (std::uint64_t)this->recovery_ticks.count();
+        }
+        if (tick >= this->acknowledge_tick) {
+            for (std::size_t i = 0; i < (std::size_t)Error::COUNT; i++) {
+                settings.reset_error((Error)i);
+            }
+            settings.set_active();
+            this->acknowledge_tick = never;
+        }
+    }
+}; //class ErrorInjection
+
+//one point of the parameter grid of a sweep
+struct SweepPoint {
+    std::size_t queue_slots;
+    Speed motor_speed; //all axes
+    std::chrono::milliseconds arrival_interval;
+    Length box_height;
+    Position wait_pos;
+
+    //nominal_positions with the parameters of the point
+    GripperPositionParameters positions() const {
+        GripperPositionParameters p = nominal_positions;
+        p.box_height = this->box_height;
+        p.wait_pos = this->wait_pos;
+        return p;
+    }
+};
+
+//random deviations from the nominal behaviour of the machine, the same for every point of a sweep
+struct SweepDisturbances {
+    Inlet::Arrivals arrivals = Inlet::Arrivals::Exponential;
+    PlantDisturbances plant = { .speed_variance = 0.1, .piston_delay_probability = 0.05, .max_piston_delay = 5 };
+    std::chrono::seconds mean_error_interval = std::chrono::seconds(120);
+    std::chrono::seconds error_recovery = std::chrono::seconds(5);
+};
+
+struct SweepResult {
+    double boxes_per_hour;
+    std::uint64_t nr_misplaced;
+    std::uint64_t nr_collisions;
+    std::uint64_t nr_missed;
+};
+
+//runs the program together with the plant in virtual time (as fast as possible) and returns the throughput.
+//every random source gets its own seed derived from seed, thus a run is reproducible from point and seed.
+//expects a thread of its own, see run_jobs.
+SweepResult simulate_throughput(SweepPoint const& point, SweepDisturbances const& disturbances, std::uint64_t const seed,
+    std::uint64_t const nr_ticks, std::chrono::nanoseconds const tick_period)
+{
+    Random seeds(seed);
+    ProcessImage::reset();
+    Scheduler::set_tick_period(tick_period);
+    Inlet::queue_slots = point.queue_slots;
+    Inlet::arrivals = disturbances.arrivals;
+    Inlet::arrival_interval = point.arrival_interval;
+    Inlet::random = Random(seeds.next());
+    PlantEvents::set_disturbances(disturbances.plant, seeds.next());
+    ErrorInjection errors((double)Scheduler::to_ticks(disturbances.mean_error_interval).count(),
+        Scheduler::to_ticks(disturbances.error_recovery), seeds.next());
+
+    set_positions(point.positions());
+    Plant plant;
+    plant.x_axis.set_speed(point.motor_speed);
+    plant.y_axis.set_speed(point.motor_speed);
+    plant.z_axis.set_speed(point.motor_speed);
+    settings.set_active();
+    Program program;
+    for (std::uint64_t tick = 0; tick < nr_ticks; tick++) {
+        errors.tick(tick);
+        program.scan();
         simulate_all_parts();
+        plant.update_stacks();
+    }
+    std::chrono::duration<double> const simulated = nr_ticks * tick_period;
+    return SweepResult{ Mag::nr_stacked * 3600.0 / simulated.count(), plant.stacks.nr_misplaced, plant.stacks.nr_collisions,
+        plant.stacks.nr_missed };
+}
+
+//simulates every point of a parameter grid nr_runs times (each with a different seed for the disturbances),
+//spread over all cores, and prints the distribution of the throughput per point
+int run_sweep(std::uint64_t const nr_ticks, std::size_t const nr_runs, std::chrono::nanoseconds const tick_period) {
+    using namespace std::chrono_literals;
+    std::vector<SweepPoint> points;
+    for (Length const box_height : { 30_mm, 40_mm }) {
+        for (Length const wait_z : { 100_mm, 140_mm }) {
+            Position const wait_pos = { nominal_positions.wait_pos.x, nominal_positions.wait_pos.y, wait_z };
+            SweepPoint const geometry = { 0, {}, {}, box_height, wait_pos };
+            //e.g. wait_pos too low for higher boxes
+            if (char const* const problem = position_problem(geometry.positions())) {
+                std::cout << "skipping box height " << box_height.count() / 1000 << "mm, wait z " << wait_z.count() / 1000
+                    << "mm: " << problem << "\n";
+                continue;
+            }
+            for (std::size_t const queue_slots : { 1, 4 }) {
+                for (Speed const motor_speed : { 13_mm_per_tick, 17_mm_per_tick, 21_mm_per_tick }) {
+                    for (auto const arrival_interval : { 300ms, 600ms }) {
+                        points.push_back(SweepPoint{ queue_slots, motor_speed, arrival_interval, box_height, wait_pos });
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<SweepResult> results(points.size() * nr_runs);
+    std::size_t const nr_threads = std::max(1u, std::thread::hardware_concurrency());
+    auto const start = std::chrono::steady_clock::now();
+    run_jobs(results.size(), nr_threads, [&](std::size_t const job) {
+        results[job] = simulate_throughput(points[job / nr_runs], SweepDisturbances{}, job, nr_ticks, tick_period);
+    });
+    std::chrono::duration<double> const took = std::chrono::steady_clock::now() - start;
+
+    std::uint64_t nr_misplaced = 0;
+    std::uint64_t nr_collisions = 0;
+    std::uint64_t nr_missed = 0;
+    for (SweepResult const& result : results) {
+        nr_misplaced += result.nr_misplaced;
+        nr_collisions += result.nr_collisions;
+        nr_missed += result.nr_missed;
+    }
+    std::cout << results.size() << " runs of " << nr_ticks << " ticks on " << nr_threads << " threads took "
+        << took.count() << "s, " << nr_misplaced << " boxes misplaced, " << nr_collisions << " collisions, "
+        << nr_missed << " boxes missed\n";
+    for (std::size_t i = 0; i < points.size(); i++) {
+        Distribution dist;
+        for (std::size_t run = 0; run < nr_runs; run++) {
+            dist.add(results[i * nr_runs + run].boxes_per_hour);
+        }
+        std::cout << "queue " << points[i].queue_slots << ", speed " << points[i].motor_speed.count() / 1000 << "mm/tick"
+            << ", arrival " << points[i].arrival_interval.count() << "ms, box height " << points[i].box_height.count() / 1000
+            << "mm, wait z " << points[i].wait_pos.z.count() / 1000 << "mm: boxes per hour ";
+        dist.print(std::cout, "");
+    }
+    return 0;
+}
+
+//usage:
+//  PaletiererTest [options]               run in real time with text output
+//  PaletiererTest --analyze <files>...    print statistics of trace files
+//  PaletiererTest --watch <name>          print the image published by another process as <name>
+//  PaletiererTest --fieldbus-slave <name> simulate the devices for a master connecting to fieldbus <name>
+//  PaletiererTest --sweep <ticks> <runs>  simulate <runs> runs of <ticks> ticks per point of a parameter grid in
+//                                         virtual time, with random disturbances, and print throughput distributions
+//options:
+//  --trace <base>     write binary trace to <base>.<n>.trace instead of text output
+//  --publish <name>   publish the state of every tick as shared memory <name> instead of text output
+//  --record <file>    record the inputs of every scan to <file>
+//  --replay <file>    run in virtual time with the inputs recorded in <file> instead of the simulation
+//  --fieldbus <name>  exchange the process image with a slave process instead of simulating locally
+//  --ticks <n>        stop after n ticks
+//  --fixed-step       simulate every part in every tick instead of event driven (reference for the latter)
+//  --sim-threads <n>  as --fixed-step, but the parts split into n groups, each simulated on a thread of its own
+int main(int argc, char** argv) {
+    std::span<char const* const> const args(argv + 1, argc - 1);
+    if (args.size() >= 2 && std::string_view(args[0]) == "--analyze") {
+        return analyze_trace(args.subspan(1), TraceStateNames{ Arm::state_names, Mag::state_names, Inlet::state_names }, std::cout);
+    }
+    if (args.size() == 2 && std::string_view(args[0]) == "--watch") {
+        return watch_image(args[1]);
+    }
+    if (args.size() == 2 && std::string_view(args[0]) == "--fieldbus-slave") {
+        Plant plant;
+        return run_fieldbus_slave(args[1], simulate_all_parts);
+    }
+    if (args.size() == 3 && std::string_view(args[0]) == "--sweep") {
+        std::uint64_t const nr_ticks = std::strtoull(args[1], nullptr, 10);
+        std::size_t const nr_runs = std::strtoull(args[2], nullptr, 10);
+        if (nr_ticks == 0 || nr_runs == 0) {
+            std::cerr << "usage: " << argv[0] << " --sweep <ticks> <runs>\n";
+            return 1;
+        }
+        return run_sweep(nr_ticks, nr_runs, nominal_tick_period);
+    }
+    char const* trace_base = nullptr;
+    char const* image_name = nullptr;
+    char const* record_path = nullptr;
+    char const* replay_path = nullptr;
+    char const* fieldbus_name = nullptr;
+    std::uint64_t max_ticks = std::numeric_limits<std::uint64_t>::max();
+    bool fixed_step = false;
+    std::size_t sim_threads = 0;
+    bool valid_args = true;
+    for (std::size_t i = 0; i < args.size(); i++) {
+        std::string_view const option = args[i];
+        if (option == "--fixed-step") {
+            fixed_step = true;
+            continue;
+        }
+        if (i + 1 == args.size()) {
+            valid_args = false;
+            break;
+        }
+        char const* const value = args[++i];
+        if (option == "--trace") trace_base = value;
+        else if (option == "--publish") image_name = value;
+        else if (option == "--record") record_path = value;
+        else if (option == "--replay") replay_path = value;
+        else if (option == "--fieldbus") fieldbus_name = value;
+        else if (option == "--ticks") max_ticks = std::strtoull(value, nullptr, 10);
+        else if (option == "--sim-threads") sim_threads = std::strtoull(value, nullptr, 10);
+        else valid_args = false;
+    }
+    if (!valid_args || max_ticks == 0 || (record_path && replay_path) || (fieldbus_name && replay_path) ||
+        (sim_threads && (fieldbus_name || fixed_step)))
+    {
+        std::cerr << "usage: " << argv[0] << " [--trace <base>] [--publish <name>] [--record <file> | --replay <file>]"
+            << " [--fieldbus <name>] [--ticks <n>] [--fixed-step | --sim-threads <n>]\n"
+            << "       " << argv[0] << " --analyze <files>...\n"
+            << "       " << argv[0] << " --watch <name>\n"
+            << "       " << argv[0] << " --fieldbus-slave <name>\n"
+            << "       " << argv[0] << " --sweep <ticks> <runs>\n";
+        return 1;
+    }
 
+    using namespace std::chrono_literals;
+    auto timer = Tick(nominal_tick_period);
+    Scheduler::set_tick_period(timer.tick_period());
+    TickReport report;
+    if (trace_base) {
+        report.trace.emplace(trace_base, timer.tick_period());
+        if (!*report.trace) return 1;
+    }
+    if (image_name) {
+        report.image.emplace(image_name);
+        if (!*report.image) {
+            std::cerr << "unable to publish image as " << image_name << "\n";
+            return 1;
+        }
+    }
+    if (replay_path) {
+        return replay(replay_path, report, timer.tick_period());
+    }
+
+    std::optional<InputRecorder> recorder;
+    std::vector<std::byte> input_image;
+    if (record_path) {
+        recorder.emplace(record_path, scan_input_layout());
+        if (!*recorder) return 1;
+        input_image.resize(scan_input_layout().image_size());
+    }
+
+    std::optional<FieldbusMaster> fieldbus;
+    if (fieldbus_name) {
+        fieldbus.emplace(fieldbus_name, timer.tick_period() / 2);
+        if (!*fieldbus) {
+            std::cerr << "no fieldbus slave serving " << fieldbus_name << "\n";
+            return 1;
+        }
+    }
+
+    std::optional<Plant> plant;
+    std::optional<PlantGroups> plant_groups;
+    if (!fieldbus) {
+        plant.emplace();
+    }
+    if (sim_threads) {
+        plant_groups.emplace(sim_threads);
+    }
+    settings.set_active();
+    Program program;
+
+    while (timer.curr_tick() < max_ticks) {
+        if (recorder) {
+            capture_scan_inputs(input_image);
+            recorder->record(timer.curr_tick(), input_image);
+        }
+        program.scan();
+        if (fieldbus) {
+            fieldbus->exchange();
+        }
+        else if (plant_groups) {
+            plant_groups->simulate_tick();
+        }
+        else if (fixed_step) {
+            simulate_all_parts_fixed_step();
+        }
+        else {
+            simulate_all_parts();
+        }
+        if (plant) {
+            plant->update_stacks();
+        }
+
+        auto const tick = timer.curr_tick();
+        auto const tick_start = timer.curr_tick_start();
         auto const sleep_time = timer.wait_till_end_of_tick();
-        debug_print(sleep_time);
+        if (report.is_enabled()) {
+            report.report(make_trace_record(tick, tick_start, sleep_time));
+        }
+        else {
+            debug_print(sleep_time);
+        }
+    }
+    if (fieldbus) {
+        fieldbus->print_stats(std::cout);
+    }
+    if (plant) {
+        plant->stacks.print(std::cout);
     }
+    CycleModel::print(std::cout);
+    print_frame_stats(std::cout);
 }
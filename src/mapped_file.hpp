@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+//file mapped completely into memory.
+//all the expensive work (creating, growing and mapping the file) happens in the constructor,
+//afterwards writing to the file is nothing more than writing to memory.
+class MappedFile {
+    void* address = nullptr;
+    std::size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    void release() {
+#ifdef _WIN32
+        if (this->address) UnmapViewOfFile(this->address);
+        if (this->mapping) CloseHandle(this->mapping);
+        if (this->file != INVALID_HANDLE_VALUE) CloseHandle(this->file);
+        this->file = INVALID_HANDLE_VALUE;
+        this->mapping = nullptr;
+#else
+        if (this->address) munmap(this->address, this->length);
+#endif
+        this->address = nullptr;
+        this->length = 0;
+    }
+
+public:
+    MappedFile() = default;
+
+    //writable = true: creates (or truncates) the file at path and preallocates size bytes.
+    //writable = false: maps an existing file read only, size is ignored and taken from the file instead.
+    MappedFile(char const* const path, std::size_t const size, bool const writable = true) {
+#ifdef _WIN32
+        this->file = CreateFileA(path,
+            writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+            FILE_SHARE_READ, nullptr,
+            writable ? CREATE_ALWAYS : OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (this->file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER file_size;
+        file_size.QuadPart = (LONGLONG)size;
+        if (!writable) {
+            GetFileSizeEx(this->file, &file_size);
+        }
+        this->mapping = CreateFileMappingA(this->file, nullptr,
+            writable ? PAGE_READWRITE : PAGE_READONLY,
+            file_size.HighPart, file_size.LowPart, nullptr);
+        if (!this->mapping || file_size.QuadPart == 0) {
+            this->release();
+            return;
+        }
+        this->address = MapViewOfFile(this->mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+        this->length = (std::size_t)file_size.QuadPart;
+#else
+        int const fd = open(path, writable ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0644);
+        if (fd < 0) return;
+        std::size_t file_size = size;
+        if (writable) {
+            if (ftruncate(fd, (off_t)size) != 0) {
+                close(fd);
+                return;
+            }
+        }
+        else {
+            struct stat info;
+            fstat(fd, &info);
+            file_size = (std::size_t)info.st_size;
+        }
+        if (file_size > 0) {
+            void* const mapped = mmap(nullptr, file_size,
+                writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped != MAP_FAILED) {
+                this->address = mapped;
+                this->length = file_size;
+            }
+        }
+        close(fd); //the mapping keeps the file alive
+#endif
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            this->release();
+            std::swap(this->address, other.address);
+            std::swap(this->length, other.length);
+#ifdef _WIN32
+            std::swap(this->file, other.file);
+            std::swap(this->mapping, other.mapping);
+#endif
+        }
+        return *this;
+    }
+
+    ~MappedFile() { this->release(); }
+
+    explicit operator bool() const { return this->address != nullptr; }
+    void* data() const { return this->address; }
+    std::size_t size() const { return this->length; }
+}; //class MappedFile
+
+
+//named block of memory shared between processes on the same machine.
+//the creating process owns the name and removes it again on destruction, other processes may only open it.
+class SharedMemory {
+    void* address = nullptr;
+    std::size_t length = 0;
+    bool owner = false;
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#else
+    std::string name;
+#endif
+
+    void release() {
+#ifdef _WIN32
+        if (this->address) UnmapViewOfFile(this->address);
+        if (this->mapping) CloseHandle(this->mapping);
+        this->mapping = nullptr;
+#else
+        if (this->address) munmap(this->address, this->length);
+        if (this->owner) shm_unlink(this->name.c_str());
+#endif
+        this->address = nullptr;
+        this->length = 0;
+        this->owner = false;
+    }
+
+public:
+    SharedMemory() = default;
+
+    enum class Access {
+        Create,    //(re)creates the block with size bytes, zero initialized
+        ReadWrite, //opens an existing block of at least size bytes
+        ReadOnly,  //as ReadWrite, but without write access
+    };
+
+    SharedMemory(char const* const name, std::size_t const size, Access const access) {
+        bool const create = access == Access::Create;
+        bool const writable = access != Access::ReadOnly;
+#ifdef _WIN32
+        std::string const full_name = std::string("Local\\") + name;
+        this->mapping = create
+            ? CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, (DWORD)size, full_name.c_str())
+            : OpenFileMappingA(writable ? FILE_MAP_WRITE : FILE_MAP_READ, FALSE, full_name.c_str());
+        if (!this->mapping) return;
+        this->address = MapViewOfFile(this->mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+        if (!this->address) {
+            this->release();
+            return;
+        }
+#else
+        this->name = std::string("/") + name;
+        if (create) shm_unlink(this->name.c_str());
+        int const fd = shm_open(this->name.c_str(), create ? (O_RDWR | O_CREAT | O_EXCL) : writable ? O_RDWR : O_RDONLY, 0644);
+        if (fd < 0) return;
+        this->owner = create;
+        struct stat info;
+        if ((create && ftruncate(fd, (off_t)size) != 0) || (!create && (fstat(fd, &info) != 0 || (std::size_t)info.st_size < size))) {
+            close(fd);
+            this->release();
+            return;
+        }
+        void* const mapped = mmap(nullptr, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            this->release();
+            return;
+        }
+        this->address = mapped;
+#endif
+        this->length = size;
+    }
+
+    SharedMemory(SharedMemory const&) = delete;
+    SharedMemory& operator=(SharedMemory const&) = delete;
+
+    ~SharedMemory() { this->release(); }
+
+    explicit operator bool() const { return this->address != nullptr; }
+    void* data() const { return this->address; }
+    std::size_t size() const { return this->length; }
+}; //class SharedMemory
@@ -1,104 +1,333 @@
+#pragma once
 
 #include <cstdint>
 #include <algorithm>
 #include <vector>
-#include <algorithm>
 #include <concepts>
+#include <span>
 
-template<typename T>
-constexpr T sign(T x) {
-    if (x < 0) return -1;
-    if (x > 0) return 1;
-    return 0;
-}
+#include "process_image.hpp"
+#include "timer_wheel.hpp"
+#include "random.hpp"
+#include "slot_map.hpp"
 
+//registers every instance of Derived (per thread). things may come and go at any time (e.g. boxes simulated
+//as objects of their own), both is O(1).
 template<typename Derived>
 class SimulatedThing {
     friend Derived; //allows call of private constructor / destructor
-    static inline std::vector<Derived*> instances = {};
+    static inline thread_local SlotMap<Derived*> instances = {};
+
+    SlotHandle registration;
 
     SimulatedThing() {
         static_assert(std::derived_from<Derived, SimulatedThing<Derived>>); //see crtp
-        instances.push_back((Derived*)this);
+        this->registration = instances.insert((Derived*)this);
     }
 
     ~SimulatedThing() {
-        //expensive operation, not intended to be done until program is finished anyway
-        auto pos = std::find(instances.begin(), instances.end(), (Derived*)this);
-        instances.erase(pos);
+        instances.remove(this->registration);
     }
 
+    SimulatedThing(SimulatedThing const&) = delete;
+    SimulatedThing& operator=(SimulatedThing const&) = delete;
+
 public:
+    //stays valid as long as the thing lives, see find
+    SlotHandle handle() const { return this->registration; }
+
+    //nullptr if the thing no longer exists
+    static Derived* find(SlotHandle const handle) {
+        Derived* const* const thing = instances.find(handle);
+        return thing ? *thing : nullptr;
+    }
+
+    //in no particular order, invalidated by creating or destroying a thing
+    static std::span<Derived* const> all_instances() { return instances.values(); }
+
+    //fixed step simulation, see simulate_all_parts_fixed_step
     static void simulate_tick_for_all_instances() {
-        for (Derived* const inst : instances) {
+        for (Derived* const inst : instances.values()) {
             inst->simulate_tick();
         }
     }
 }; //class SimulatedThing
 
-class SimulatedMotor: public SimulatedThing<SimulatedMotor> {
-    std::int64_t target_pos = 0;
-    std::int64_t curr_pos = 0;
-    std::int64_t speed = 17;
+//deviations of the simulated devices from their nominal behaviour, all off by default.
+//drawn once per command (not per tick) from a seeded generator, thus a disturbed run is reproducible from its seed.
+struct PlantDisturbances {
+    double speed_variance = 0;           //speed of a movement is uniform in nominal speed * (1 +- speed_variance)
+    double piston_delay_probability = 0; //chance of a piston change taking longer than nominal
+    std::int64_t max_piston_delay = 0;   //extra ticks of a delayed change, uniform in [1, max_piston_delay]
+};
+
+//clock of the event driven simulation. devices schedule the tick their current movement completes
+//(computed from distance and speed), nothing is done for them in the ticks in between.
+class PlantEvents {
+    static inline constinit thread_local TimerWheel wheel = {};
+    static inline constinit thread_local PlantDisturbances curr_disturbances = {};
+    static inline constinit thread_local Random generator = Random(0);
 
 public:
-    SimulatedMotor() {}
+    static std::uint64_t now() { return wheel.now(); }
+    static TimerWheel& timers() { return wheel; }
 
-    bool is_moving() const { return this->curr_pos != this->target_pos; }
-    std::int64_t pos() const { return this->curr_pos; }
+    //event driven simulation only, the fixed step simulation stays the undisturbed reference
+    static void set_disturbances(PlantDisturbances const& disturbances, std::uint64_t const seed) {
+        curr_disturbances = disturbances;
+        generator = Random(seed);
+    }
+    static PlantDisturbances const& disturbances() { return curr_disturbances; }
+    static Random& random() { return generator; }
+}; //class PlantEvents
+
+
+//simulates the device behind a Motor: reads its target from the output image, writes its position to the input image.
+//per tick, a moving motor costs one position update (computed from the start of the movement), a standing one nothing.
+//bound to the images of the thread it was created in, thus the fixed step simulation may run on any thread
+//(see PlantGroups, which also redirects the inputs). every device has cache lines of its own, as devices next to
+//each other (e.g. in Plant) may be simulated by different threads.
+class alignas(64) SimulatedMotor: public SimulatedThing<SimulatedMotor> {
+    static constexpr std::size_t not_moving = -1;
+    static inline constinit thread_local std::array<SimulatedMotor*, max_motors> by_index = {};
+    static inline thread_local std::vector<SimulatedMotor*> moving = {};
+
+public:
+    static constexpr Speed nominal_speed = millimetres_per_tick(17);
+
+private:
+    std::size_t index;
+    MotorInputs* field_inputs = &ProcessImage::field_input_image().motors[this->index];
+    OutputImage const& field_outputs = ProcessImage::field_output_image();
+    Length curr_pos = {};
+    Speed speed = nominal_speed;
 
-    void go_to_pos(std::int64_t pos) {
-        this->target_pos = pos;
+    //current movement
+    Speed movement_speed = nominal_speed;
+    Length start_pos = {};
+    Length target_pos = {};
+    std::uint64_t start_tick = 0;
+    std::size_t moving_index = not_moving;
+    TimerNode arrival = { [](void* self) { ((SimulatedMotor*)self)->stop_moving(); }, this };
+
+    void write_pos() const {
+        this->field_inputs->pos = this->curr_pos;
     }
 
+    void stop_moving() {
+        if (this->moving_index == not_moving) return;
+        moving[this->moving_index] = moving.back();
+        moving[this->moving_index]->moving_index = this->moving_index;
+        moving.pop_back();
+        this->moving_index = not_moving;
+    }
+
+    Speed draw_movement_speed() const {
+        double const variance = PlantEvents::disturbances().speed_variance;
+        if (variance == 0) return this->speed;
+        double const factor = 1 + variance * (2 * PlantEvents::random().uniform() - 1);
+        return Speed(std::max<std::int64_t>(1, std::llround(this->speed.count() * factor)));
+    }
+
+    //the target changed in tick, the first step is done in that tick
+    void command(std::uint64_t const tick) {
+        TimerWheel::cancel(this->arrival);
+        this->start_pos = this->curr_pos;
+        this->target_pos = this->field_outputs.motors[this->index].target_pos;
+        this->start_tick = tick;
+        if (this->target_pos == this->curr_pos) {
+            this->stop_moving();
+            return;
+        }
+        if (this->moving_index == not_moving) {
+            this->moving_index = moving.size();
+            moving.push_back(this);
+        }
+        this->movement_speed = this->draw_movement_speed();
+        Ticks const nr_steps = ticks_to_cover(abs(this->target_pos - this->start_pos), this->movement_speed);
+        //the position is already written in the tick of the last step, the motor is only dropped the tick after
+        PlantEvents::timers().insert(this->arrival, tick + nr_steps.count());
+    }
+
+    void step(std::uint64_t const tick) {
+        Length const diff = this->target_pos - this->start_pos;
+        Length const travelled = std::min(abs(diff), this->movement_speed * Ticks((std::int64_t)(tick - this->start_tick + 1)));
+        this->curr_pos = this->start_pos + (diff < Length() ? -travelled : travelled);
+        this->write_pos();
+    }
+
+public:
+    SimulatedMotor(Motor const& motor) :index(motor.image_index()) {
+        by_index[this->index] = this;
+        this->write_pos();
+    }
+
+    ~SimulatedMotor() {
+        TimerWheel::cancel(this->arrival);
+        this->stop_moving();
+        by_index[this->index] = nullptr;
+    }
+
+    //takes effect with the next command
+    void set_speed(Speed const speed) { this->speed = speed; }
+
+    Length pos() const { return this->curr_pos; }
+    std::size_t image_index() const { return this->index; }
+
+    //from now on the inputs are written to inputs instead of the input image
+    void redirect_inputs(MotorInputs& inputs) {
+        this->field_inputs = &inputs;
+        this->write_pos();
+    }
+
+    //fixed step simulation
     void simulate_tick() {
-        const std::int64_t diff = this->target_pos - this->curr_pos;
-        const std::int64_t step = std::min(std::abs(diff), speed);
-        this->curr_pos += sign(diff) * step;
+        Length const target_pos = this->field_outputs.motors[this->index].target_pos;
+        Length const diff = target_pos - this->curr_pos;
+        Length const step = std::min(abs(diff), this->speed * Ticks(1));
+        this->curr_pos += diff < Length() ? -step : step;
+        this->write_pos();
     }
 
-    void stop() {
-        this->target_pos = this->curr_pos;
+    //event driven simulation, tick is the tick currently simulated
+    static void commands(std::uint32_t changed, std::uint64_t const tick) {
+        for (std::size_t i = 0; changed; i++, changed >>= 1) {
+            if ((changed & 1) && by_index[i]) by_index[i]->command(tick);
+        }
     }
-}; //struct SimulatedMotor
 
+    static void step_moving(std::uint64_t const tick) {
+        for (SimulatedMotor* const motor : moving) {
+            motor->step(tick);
+        }
+    }
+}; //struct SimulatedMotor
 
-class SimulatedPiston: public SimulatedThing<SimulatedPiston> {
-    bool curr_extended = true;
-    int ticks_until_change = 0;
 
+//simulates the device behind a Piston: a change of the commanded position takes 3 ticks (plus disturbances).
+//bound to the images of the thread it was created in and on cache lines of its own, as SimulatedMotor.
+class alignas(64) SimulatedPiston: public SimulatedThing<SimulatedPiston> {
 public:
-    SimulatedPiston() {}
+    static constexpr int change_ticks = 3;
+
+private:
+    static inline constinit thread_local std::array<SimulatedPiston*, max_pistons> by_index = {};
+
+    std::size_t index;
+    PistonInputs* field_inputs = &ProcessImage::field_input_image().pistons[this->index];
+    OutputImage const& field_outputs = ProcessImage::field_output_image();
+    bool curr_extended;
+    int ticks_until_change = 0; //fixed step simulation only
+    //change_done fires at the end of a change, or (restart set) one tick after a change completed against the command,
+    //the completed state is visible in between as in the fixed step simulation
+    bool restart = false;
+    TimerNode change_done = { [](void* self) { ((SimulatedPiston*)self)->on_timer(); }, this };
+
+    bool is_changing() const {
+        return this->ticks_until_change != 0 || (this->change_done.is_pending() && !this->restart);
+    }
+
+    void write_sensors() const {
+        PistonInputs& in = *this->field_inputs;
+        in.extended_sensor = !this->is_changing() && this->curr_extended;
+        in.retracted_sensor = !this->is_changing() && !this->curr_extended;
+    }
+
+    bool commanded_extend() const { return this->field_outputs.pistons[this->index].extend; }
+
+    static std::int64_t draw_delay() {
+        PlantDisturbances const& disturbances = PlantEvents::disturbances();
+        if (disturbances.piston_delay_probability == 0 || disturbances.max_piston_delay <= 0) return 0;
+        if (PlantEvents::random().uniform() >= disturbances.piston_delay_probability) return 0;
+        return PlantEvents::random().uniform(1, disturbances.max_piston_delay);
+    }
 
-    bool is_moving() const { return this->ticks_until_change != 0;  }
-    bool is_extended() const { return !this->is_moving() && this->curr_extended; }
-    bool is_retracted() const { return !this->is_moving() && !this->curr_extended; }
+    void command(std::uint64_t const tick) {
+        if (this->change_done.is_pending() || this->commanded_extend() == this->curr_extended) return;
+        PlantEvents::timers().insert(this->change_done, tick + change_ticks - 1 + draw_delay());
+        this->write_sensors();
+    }
 
-    void extend() {
-        if (!this->curr_extended) {
-            this->ticks_until_change = 3;
+    void complete_change() {
+        this->curr_extended = !this->curr_extended;
+        //the command changed again during the change, start over in the next tick
+        if (this->commanded_extend() != this->curr_extended) {
+            this->restart = true;
+            PlantEvents::timers().insert(this->change_done, PlantEvents::now() + 1);
         }
+        this->write_sensors();
     }
 
-    void retract() {
-        if (this->curr_extended) {
-            this->ticks_until_change = 3;
+    void on_timer() {
+        if (!this->restart) {
+            this->complete_change();
+            return;
         }
+        this->restart = false;
+        this->command(PlantEvents::now());
+    }
+
+public:
+    SimulatedPiston(Piston const& piston) 
+        :index(piston.image_index()),
+        curr_extended(this->field_outputs.pistons[this->index].extend)
+    {
+        by_index[this->index] = this;
+        this->write_sensors();
+    }
+
+    ~SimulatedPiston() {
+        TimerWheel::cancel(this->change_done);
+        by_index[this->index] = nullptr;
+    }
+
+    bool is_extended() const { return !this->is_changing() && this->curr_extended; }
+    bool is_retracted() const { return !this->is_changing() && !this->curr_extended; }
+    std::size_t image_index() const { return this->index; }
+
+    //as SimulatedMotor::redirect_inputs
+    void redirect_inputs(PistonInputs& inputs) {
+        this->field_inputs = &inputs;
+        this->write_sensors();
     }
 
+    //fixed step simulation
     void simulate_tick() {
+        bool const extend = this->commanded_extend();
+        if (this->ticks_until_change == 0 && extend != this->curr_extended) {
+            this->ticks_until_change = change_ticks;
+        }
         if (this->ticks_until_change > 0) {
             this->ticks_until_change--;
             if (this->ticks_until_change == 0) {
                 this->curr_extended = !this->curr_extended;
             }
         }
+        this->write_sensors();
+    }
+
+    //event driven simulation, tick is the tick currently simulated
+    static void commands(std::uint32_t changed, std::uint64_t const tick) {
+        for (std::size_t i = 0; changed; i++, changed >>= 1) {
+            if ((changed & 1) && by_index[i]) by_index[i]->command(tick);
+        }
     }
 }; //struct SimulatedPiston
 
 
+//simulates every part for one tick. event driven: only parts with a new command, a completed movement
+//or (motors only) a movement in progress cost anything, idle parts are not touched at all.
 void simulate_all_parts() {
+    std::uint64_t const tick = PlantEvents::now() + 1;
+    PlantEvents::timers().advance(tick); //completions
+    ChangedOutputs const changed = ProcessImage::take_changed_outputs();
+    SimulatedMotor::commands(changed.motors, tick);
+    SimulatedPiston::commands(changed.pistons, tick);
+    SimulatedMotor::step_moving(tick);
+}
+
+//simulates every part for one tick, the reference for simulate_all_parts
+void simulate_all_parts_fixed_step() {
     SimulatedThing<SimulatedMotor>::simulate_tick_for_all_instances();
     SimulatedThing<SimulatedPiston>::simulate_tick_for_all_instances();
 }
-
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cassert>
+#include <array>
+#include <barrier>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "motors.hpp"
+
+
+//fixed step simulation of the parts split into groups (e.g. one per cell of a plant), each group on a thread of its own.
+//the thread calling simulate_tick simulates the first group itself and meets the others at a barrier at the start
+//and at the end of the tick, thus afterwards every part has completed the tick, as after simulate_all_parts_fixed_step.
+//
+//no cache line is written by two threads during a tick: the entries of the input image are far smaller than a cache
+//line, thus the parts of a group write their inputs to a slice of their own, copied into the image by the calling
+//thread after the end of the tick. the devices themselves are on cache lines of their own (see SimulatedMotor).
+//only worth it once a group has far more work per tick than a barrier costs.
+class PlantGroups {
+    struct alignas(64) Group {
+        //indexed as the image, only the entries of the parts of the group are used
+        std::array<MotorInputs, max_motors> motor_inputs = {};
+        std::array<PistonInputs, max_pistons> piston_inputs = {};
+        std::vector<SimulatedMotor*> motors;
+        std::vector<SimulatedPiston*> pistons;
+
+        void simulate_tick() const {
+            for (SimulatedMotor* const motor : this->motors) motor->simulate_tick();
+            for (SimulatedPiston* const piston : this->pistons) piston->simulate_tick();
+        }
+
+        void copy_inputs(InputImage& image) const {
+            for (SimulatedMotor const* const motor : this->motors) {
+                image.motors[motor->image_index()] = this->motor_inputs[motor->image_index()];
+            }
+            for (SimulatedPiston const* const piston : this->pistons) {
+                image.pistons[piston->image_index()] = this->piston_inputs[piston->image_index()];
+            }
+        }
+    }; //struct Group
+
+    std::vector<Group> groups;
+    std::barrier<> tick_sync;
+    bool stopping = false; //written before the barrier, read after it
+    std::vector<std::thread> workers;
+
+    template<typename Part, typename Inputs, std::size_t n>
+    void assign(std::vector<Part*> Group::* const parts, std::array<Inputs, n> Group::* const inputs) {
+        std::span<Part* const> const all = SimulatedThing<Part>::all_instances();
+        for (std::size_t i = 0; i < all.size(); i++) {
+            Group& group = this->groups[i * this->groups.size() / all.size()];
+            (group.*parts).push_back(all[i]);
+            all[i]->redirect_inputs((group.*inputs)[all[i]->image_index()]);
+        }
+    }
+
+    void work(std::size_t const group) {
+        while (true) {
+            this->tick_sync.arrive_and_wait(); //start of tick, the outputs are flushed
+            if (this->stopping) return;
+            this->groups[group].simulate_tick();
+            this->tick_sync.arrive_and_wait(); //end of tick
+        }
+    }
+
+public:
+    //splits the parts existing right now, parts created later are not simulated
+    explicit PlantGroups(std::size_t const nr_groups)
+        :groups(nr_groups),
+        tick_sync((std::ptrdiff_t)nr_groups)
+    {
+        assert(nr_groups > 0);
+        this->assign(&Group::motors, &Group::motor_inputs);
+        this->assign(&Group::pistons, &Group::piston_inputs);
+        for (std::size_t i = 1; i < nr_groups; i++) {
+            this->workers.emplace_back([this, i] { this->work(i); });
+        }
+    }
+
+    PlantGroups(PlantGroups const&) = delete;
+    PlantGroups& operator=(PlantGroups const&) = delete;
+
+    //the parts write to the input image again afterwards
+    ~PlantGroups() {
+        this->stopping = true;
+        this->tick_sync.arrive_and_wait();
+        for (std::thread& worker : this->workers) {
+            worker.join();
+        }
+        InputImage& image = ProcessImage::field_input_image();
+        for (Group& group : this->groups) {
+            for (SimulatedMotor* const motor : group.motors) motor->redirect_inputs(image.motors[motor->image_index()]);
+            for (SimulatedPiston* const piston : group.pistons) piston->redirect_inputs(image.pistons[piston->image_index()]);
+        }
+    }
+
+    std::size_t group_count() const { return this->groups.size(); }
+
+    void simulate_tick() {
+        this->tick_sync.arrive_and_wait();
+        this->groups[0].simulate_tick();
+        this->tick_sync.arrive_and_wait();
+        InputImage& image = ProcessImage::field_input_image();
+        for (Group const& group : this->groups) {
+            group.copy_inputs(image);
+        }
+    }
+}; //class PlantGroups
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <array>
+#include <type_traits>
+
+#include "units.hpp"
+
+
+//the program never talks to devices directly, but only to the process image (as a PLC does):
+//at the start of each scan the inputs are latched into a snapshot that stays constant during the scan,
+//outputs are collected and only handed to the devices at the end of the scan.
+//thus what a coroutine sees does not depend on the order the coroutines (or the devices) are run in.
+//
+//both images are plain contiguous structs, thus the exchange with the field (simulation or fieldbus) is a single copy.
+//
+//the images are thread_local, thus several simulations may run in parallel (one per thread).
+//the set of devices is the same for all of them.
+
+struct MotorInputs { Length pos; };
+struct MotorOutputs { Length target_pos; };
+struct PistonInputs { std::uint8_t extended_sensor; std::uint8_t retracted_sensor; };
+struct PistonOutputs { std::uint8_t extend; };
+
+constexpr std::size_t max_motors = 8;
+constexpr std::size_t max_pistons = 8;
+
+struct InputImage {
+    std::array<MotorInputs, max_motors> motors;
+    std::array<PistonInputs, max_pistons> pistons;
+};
+
+struct OutputImage {
+    std::array<MotorOutputs, max_motors> motors;
+    std::array<PistonOutputs, max_pistons> pistons;
+};
+
+static_assert(std::is_trivially_copyable_v<InputImage>);
+static_assert(std::is_trivially_copyable_v<OutputImage>);
+
+//bit i set: output of device i changed
+struct ChangedOutputs {
+    std::uint32_t motors = 0;
+    std::uint32_t pistons = 0;
+};
+static_assert(max_motors <= 32 && max_pistons <= 32);
+
+
+class ProcessImage {
+    //each buffer gets its own cache lines, as field and program side are touched at different times.
+    //the entries of one buffer share cache lines, thus only one thread at a time may write a buffer
+    //(PlantGroups gives each of its threads a slice of its own instead)
+    alignas(64) static inline constinit thread_local InputImage field_inputs = {}; //written by the field
+    alignas(64) static inline constinit thread_local InputImage inputs = {};       //snapshot read by the program
+    alignas(64) static inline constinit thread_local OutputImage outputs = {};     //written by the program
+    alignas(64) static inline constinit thread_local OutputImage field_outputs = {}; //read by the field
+
+    //written outputs are marked during the scan and handed to the field together with the outputs,
+    //thus an event driven field only needs to look at the devices that got a new command
+    static inline constinit thread_local ChangedOutputs changed = {};
+    static inline constinit thread_local ChangedOutputs field_changed = {};
+
+    //shared by all threads, the devices are created once at startup
+    static inline constinit std::size_t nr_motors = 0;
+    static inline constinit std::size_t nr_pistons = 0;
+    static inline constinit OutputImage initial_outputs = {};
+
+    friend class Motor;
+    friend class Piston;
+
+public:
+    //puts the images of the current thread into the state after startup, needed before a simulation
+    //runs in a thread other than the one the devices were created in
+    static void reset() {
+        field_inputs = {};
+        inputs = {};
+        outputs = initial_outputs;
+        field_outputs = initial_outputs;
+        changed = {};
+        field_changed = {};
+    }
+
+    //called at the start of a scan
+    static void latch_inputs() { inputs = field_inputs; }
+    //called at the end of a scan
+    static void flush_outputs() {
+        field_outputs = outputs;
+        field_changed.motors |= changed.motors;
+        field_changed.pistons |= changed.pistons;
+        changed = {};
+    }
+
+    static std::size_t motor_count() { return nr_motors; }
+    static std::size_t piston_count() { return nr_pistons; }
+
+    //field side
+    static InputImage& field_input_image() { return field_inputs; }
+    static OutputImage& field_output_image() { return field_outputs; }
+
+    //outputs changed since the last call
+    static ChangedOutputs take_changed_outputs() {
+        ChangedOutputs const result = field_changed;
+        field_changed = {};
+        return result;
+    }
+
+    //field side, for outputs not written by flush_outputs (e.g. received over the fieldbus)
+    static void mark_all_outputs_changed() {
+        field_changed.motors = (std::uint32_t)((std::uint64_t(1) << nr_motors) - 1);
+        field_changed.pistons = (std::uint32_t)((std::uint64_t(1) << nr_pistons) - 1);
+    }
+}; //class ProcessImage
+
+
+//program side of a motor. only reads the latched inputs and its own outputs.
+class Motor {
+    std::size_t index;
+
+    MotorInputs const& in() const { return ProcessImage::inputs.motors[this->index]; }
+    MotorOutputs& out() const { return ProcessImage::outputs.motors[this->index]; }
+
+public:
+    Motor() :index(ProcessImage::nr_motors++) {
+        assert(this->index < max_motors);
+    }
+
+    std::size_t image_index() const { return this->index; }
+
+    bool is_moving() const { return this->in().pos != this->out().target_pos; }
+    Length pos() const { return this->in().pos; }
+
+    void go_to_pos(Length const pos) {
+        if (this->out().target_pos != pos) {
+            this->out().target_pos = pos;
+            ProcessImage::changed.motors |= std::uint32_t(1) << this->index;
+        }
+    }
+
+    void stop() { this->go_to_pos(this->in().pos); }
+}; //class Motor
+
+
+//program side of a piston with a sensor in each end position.
+class Piston {
+    std::size_t index;
+
+    PistonInputs const& in() const { return ProcessImage::inputs.pistons[this->index]; }
+    PistonOutputs& out() const { return ProcessImage::outputs.pistons[this->index]; }
+
+    void set_extend(bool const extend) {
+        if (this->out().extend != extend) {
+            this->out().extend = extend;
+            ProcessImage::changed.pistons |= std::uint32_t(1) << this->index;
+        }
+    }
+
+public:
+    Piston(bool const initially_extended = true) :index(ProcessImage::nr_pistons++) {
+        assert(this->index < max_pistons);
+        this->out().extend = initially_extended;
+        ProcessImage::field_outputs.pistons[this->index].extend = initially_extended;
+        ProcessImage::initial_outputs.pistons[this->index].extend = initially_extended;
+    }
+
+    std::size_t image_index() const { return this->index; }
+
+    //only true once the sensor confirms the commanded position
+    bool is_extended() const { return this->out().extend && this->in().extended_sensor; }
+    bool is_retracted() const { return !this->out().extend && this->in().retracted_sensor; }
+    bool is_moving() const { return !this->is_extended() && !this->is_retracted(); }
+
+    void extend() { this->set_extend(true); }
+    void retract() { this->set_extend(false); }
+}; //class Piston
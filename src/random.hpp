@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <cmath>
+
+
+//xoshiro256** seeded with splitmix64. small, fast and the same sequence on every platform (unlike the
+//distributions of <random>), thus a simulation run is reproducible from its seed alone. not for cryptography.
+class Random {
+    std::array<std::uint64_t, 4> state = {};
+
+    static constexpr std::uint64_t rotl(std::uint64_t const x, int const k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+public:
+    constexpr explicit Random(std::uint64_t seed) {
+        for (std::uint64_t& s : this->state) {
+            seed += 0x9e3779b97f4a7c15;
+            std::uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            s = z ^ (z >> 31);
+        }
+    }
+
+    constexpr std::uint64_t next() {
+        std::uint64_t const result = rotl(this->state[1] * 5, 7) * 9;
+        std::uint64_t const t = this->state[1] << 17;
+        this->state[2] ^= this->state[0];
+        this->state[3] ^= this->state[1];
+        this->state[1] ^= this->state[2];
+        this->state[0] ^= this->state[3];
+        this->state[2] ^= t;
+        this->state[3] = rotl(this->state[3], 45);
+        return result;
+    }
+
+    //in [0, 1)
+    constexpr double uniform() { return (this->next() >> 11) * 0x1.0p-53; }
+
+    //exponentially distributed with the given mean, e.g. the time between events happening at a constant rate
+    double exponential(double const mean) { return -mean * std::log(1 - this->uniform()); }
+
+    //in [lo, hi]. the modulo bias is negligible for the small ranges used here.
+    constexpr std::int64_t uniform(std::int64_t const lo, std::int64_t const hi) {
+        return lo + (std::int64_t)(this->next() % (std::uint64_t)(hi - lo + 1));
+    }
+}; //class Random
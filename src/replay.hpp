@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <array>
+#include <span>
+#include <vector>
+#include <fstream>
+#include <type_traits>
+
+
+//the inputs of one scan are stored as one contiguous image of bytes, split into slots.
+//a slot is the unit of change detection: a recorded frame only contains the slots that changed since the last frame.
+//thus ticks without any input change cost nothing and a moving axis costs only its own slot.
+struct InputLayout {
+    static constexpr std::size_t max_slots = 64; //one bit per slot in the change mask of each frame
+    std::vector<std::uint32_t> slot_sizes;
+
+    std::size_t image_size() const {
+        std::size_t size = 0;
+        for (std::uint32_t const s : this->slot_sizes) size += s;
+        return size;
+    }
+
+    template<typename T>
+    void add_slot() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        this->slot_sizes.push_back((std::uint32_t)sizeof(T));
+    }
+}; //struct InputLayout
+
+//helpers to write / read one slot after the other to / from an input image
+template<typename T>
+void store_slot(std::span<std::byte>& image, T const& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    std::memcpy(image.data(), &value, sizeof(T));
+    image = image.subspan(sizeof(T));
+}
+
+template<typename T>
+void load_slot(std::span<std::byte const>& image, T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    std::memcpy(&value, image.data(), sizeof(T));
+    image = image.subspan(sizeof(T));
+}
+
+namespace replay_detail {
+    constexpr std::array<char, 8> magic = { 'P', 'A', 'L', 'I', 'N', 'P', 'U', 'T' };
+    constexpr std::uint32_t version = 1;
+
+    //frame layout: u64 tick, u64 change mask, then the bytes of every changed slot in slot order.
+    //the file ends after the last complete frame: there is no end marker, as a killed program never writes one.
+} //namespace replay_detail
+
+
+//appends the input image of every tick to a file, but only if something changed.
+//every frame is handed to the os right away (one write per changed tick), thus the recording survives the program
+//being killed, which is how the realtime loop usually ends. especially the ticks right before a fault are kept.
+class InputRecorder {
+    std::ofstream out;
+    InputLayout layout;
+    std::vector<std::byte> prev_image;
+    std::vector<std::byte> frame; //assembled here, thus written at once
+    bool has_prev = false;
+    std::uint64_t last_tick = 0;
+
+    void append(void const* const data, std::size_t const size) {
+        std::byte const* const bytes = (std::byte const*)data;
+        this->frame.insert(this->frame.end(), bytes, bytes + size);
+    }
+
+    void write_frame() {
+        this->out.write((char const*)this->frame.data(), (std::streamsize)this->frame.size());
+        this->out.flush();
+        this->frame.clear();
+    }
+
+public:
+    InputRecorder(char const* const path, InputLayout layout)
+        :out(path, std::ios::binary | std::ios::trunc),
+        layout(std::move(layout)),
+        prev_image(this->layout.image_size())
+    {
+        assert(this->layout.slot_sizes.size() <= InputLayout::max_slots);
+        std::uint32_t const nr_slots = (std::uint32_t)this->layout.slot_sizes.size();
+        this->frame.reserve(2 * sizeof(std::uint64_t) + this->prev_image.size());
+        this->append(replay_detail::magic.data(), replay_detail::magic.size());
+        this->append(&replay_detail::version, sizeof(replay_detail::version));
+        this->append(&nr_slots, sizeof(nr_slots));
+        this->append(this->layout.slot_sizes.data(), nr_slots * sizeof(std::uint32_t));
+        this->write_frame();
+    }
+
+    //a replay ends with the last frame. on a regular end an empty frame adds the ticks since the last change.
+    ~InputRecorder() {
+        if (this->has_prev) {
+            std::uint64_t const no_change = 0;
+            this->append(&this->last_tick, sizeof(this->last_tick));
+            this->append(&no_change, sizeof(no_change));
+            this->write_frame();
+        }
+    }
+
+    explicit operator bool() const { return (bool)this->out; }
+
+    void record(std::uint64_t const tick, std::span<std::byte const> const image) {
+        assert(image.size() == this->prev_image.size());
+        this->last_tick = tick;
+        std::uint64_t changed = 0;
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i < this->layout.slot_sizes.size(); i++) {
+            std::uint32_t const size = this->layout.slot_sizes[i];
+            if (!this->has_prev || std::memcmp(image.data() + offset, this->prev_image.data() + offset, size) != 0) {
+                changed |= std::uint64_t(1) << i;
+            }
+            offset += size;
+        }
+        if (!changed) return;
+
+        this->append(&tick, sizeof(tick));
+        this->append(&changed, sizeof(changed));
+        offset = 0;
+        for (std::size_t i = 0; i < this->layout.slot_sizes.size(); i++) {
+            std::uint32_t const size = this->layout.slot_sizes[i];
+            if (changed & (std::uint64_t(1) << i)) {
+                this->append(image.data() + offset, size);
+            }
+            offset += size;
+        }
+        this->write_frame();
+        std::memcpy(this->prev_image.data(), image.data(), image.size());
+        this->has_prev = true;
+    }
+}; //class InputRecorder
+
+
+//reads a file written by InputRecorder and reconstructs the input image of every tick.
+//the recording ends with the last complete frame, a frame cut off by the end of the file is ignored.
+class InputReplayer {
+    std::ifstream in;
+    InputLayout layout;
+    std::vector<std::byte> curr_image;
+    std::uint64_t next_frame_tick = 0;
+    std::uint64_t next_frame_mask = 0;
+    std::vector<std::byte> next_frame_slots; //bytes of the changed slots, in slot order
+    bool has_next_frame = false;
+    bool valid = false;
+
+    void read_frame() {
+        this->has_next_frame =
+            (bool)this->in.read((char*)&this->next_frame_tick, sizeof(this->next_frame_tick)) &&
+            (bool)this->in.read((char*)&this->next_frame_mask, sizeof(this->next_frame_mask));
+        if (!this->has_next_frame) return;
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < this->layout.slot_sizes.size(); i++) {
+            if (this->next_frame_mask & (std::uint64_t(1) << i)) size += this->layout.slot_sizes[i];
+        }
+        this->next_frame_slots.resize(size);
+        this->has_next_frame = (bool)this->in.read((char*)this->next_frame_slots.data(), (std::streamsize)size);
+    }
+
+public:
+    //expected_layout is compared against the layout stored in the file
+    InputReplayer(char const* const path, InputLayout const& expected_layout)
+        :in(path, std::ios::binary)
+    {
+        std::array<char, 8> file_magic = {};
+        std::uint32_t file_version = 0;
+        std::uint32_t nr_slots = 0;
+        this->in.read(file_magic.data(), file_magic.size());
+        this->in.read((char*)&file_version, sizeof(file_version));
+        this->in.read((char*)&nr_slots, sizeof(nr_slots));
+        if (!this->in || file_magic != replay_detail::magic || file_version != replay_detail::version ||
+            nr_slots > InputLayout::max_slots)
+        {
+            return;
+        }
+        this->layout.slot_sizes.resize(nr_slots);
+        this->in.read((char*)this->layout.slot_sizes.data(), nr_slots * sizeof(std::uint32_t));
+        if (!this->in || this->layout.slot_sizes != expected_layout.slot_sizes) {
+            return;
+        }
+        this->curr_image.resize(this->layout.image_size());
+        this->read_frame();
+        this->valid = true;
+    }
+
+    //false if the file is no recording of the expected layout
+    explicit operator bool() const { return this->valid; }
+
+    //true as long as there are frames left. the inputs after the last recorded tick are unknown
+    bool has_more() const { return this->has_next_frame; }
+
+    //returns the input image for tick. ticks have to be requested in increasing order.
+    std::span<std::byte const> inputs_at(std::uint64_t const tick) {
+        while (this->has_next_frame && this->next_frame_tick <= tick) {
+            std::size_t offset = 0;
+            std::byte const* src = this->next_frame_slots.data();
+            for (std::size_t i = 0; i < this->layout.slot_sizes.size(); i++) {
+                std::uint32_t const size = this->layout.slot_sizes[i];
+                if (this->next_frame_mask & (std::uint64_t(1) << i)) {
+                    std::memcpy(this->curr_image.data() + offset, src, size);
+                    src += size;
+                }
+                offset += size;
+            }
+            this->read_frame();
+        }
+        return this->curr_image;
+    }
+}; //class InputReplayer
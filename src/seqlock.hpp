@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <atomic>
+#include <type_traits>
+
+
+//single writer, any number of readers. the writer never waits, readers retry if they raced with a write.
+//the data is stored as relaxed atomic words, thus the layout is address free and can live in shared memory.
+template<typename T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable_v<T>);
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free); //lock free atomics are required to work across processes
+
+    static constexpr std::size_t nr_words = (sizeof(T) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+    //odd while a write is in progress
+    alignas(64) std::atomic<std::uint64_t> sequence = 0;
+    alignas(64) std::array<std::atomic<std::uint64_t>, nr_words> words = {};
+
+public:
+    void write(T const& value) {
+        std::array<std::uint64_t, nr_words> buffer = {};
+        std::memcpy(buffer.data(), &value, sizeof(T));
+
+        std::uint64_t const seq = this->sequence.load(std::memory_order_relaxed);
+        this->sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (std::size_t i = 0; i < nr_words; i++) {
+            this->words[i].store(buffer[i], std::memory_order_relaxed);
+        }
+        this->sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    //returns false if a write happened at the same time, result is unspecified in that case
+    bool try_read(T& result) const {
+        std::uint64_t const seq_before = this->sequence.load(std::memory_order_acquire);
+        if (seq_before & 1) return false;
+
+        std::array<std::uint64_t, nr_words> buffer;
+        for (std::size_t i = 0; i < nr_words; i++) {
+            buffer[i] = this->words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (this->sequence.load(std::memory_order_relaxed) != seq_before) return false;
+
+        std::memcpy(&result, buffer.data(), sizeof(T));
+        return true;
+    }
+
+    //number of completed writes
+    std::uint64_t version() const { return this->sequence.load(std::memory_order_acquire) / 2; }
+}; //class Seqlock
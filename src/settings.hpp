@@ -1,12 +1,16 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
+
+#include "cancellation.hpp"
 
 template<typename Error>
 class Settings {
     bool active = false;
     std::size_t nr_errors = 0;
     std::array<bool, (std::size_t)Error::COUNT> curr_errors = {};
+    CancellationSource on_error = {}; //cancelled by the first error, reset once all errors are gone
 
     static constexpr std::size_t to_id(Error err) {
         std::size_t const err_id = static_cast<std::size_t>(err);
@@ -20,6 +24,37 @@ public:
     std::size_t curr_error_count() const { return this->nr_errors; }
     bool error_is_set(Error const err) const { return this->curr_errors[to_id(err)]; }
 
+    //bit i is set if error with id i is set
+    std::uint64_t error_bits() const {
+        static_assert((std::size_t)Error::COUNT <= 64);
+        std::uint64_t bits = 0;
+        for (std::size_t i = 0; i < this->curr_errors.size(); i++) {
+            bits |= (std::uint64_t)this->curr_errors[i] << i;
+        }
+        return bits;
+    }
+
+    //cancelled as soon as any error is set.
+    //tokens handed out stay cancelled, even after all errors are reset; ask for a new one afterwards.
+    CancellationToken error_token() const { return this->on_error.token(); }
+
+    //everything needed to restore the settings, e.g. when replaying a recording
+    struct Snapshot {
+        std::uint64_t error_bits;
+        std::uint64_t active; //not bool, so the snapshot has no padding bytes
+    };
+
+    Snapshot snapshot() const { return Snapshot{ this->error_bits(), this->active }; }
+
+    //sets and resets errors (thus cancels the error token) as if done by set_error and reset_error
+    void restore(Snapshot const& snap) {
+        for (std::size_t i = 0; i < this->curr_errors.size(); i++) {
+            if ((snap.error_bits >> i) & 1) this->set_error((Error)i);
+            else this->reset_error((Error)i);
+        }
+        this->active = snap.active && !this->has_error();
+    }
+
     constexpr Settings() {}
 
     void set_error(Error const err) {
@@ -27,11 +62,16 @@ public:
         this->active = false;
         this->nr_errors += 1 - this->curr_errors[err_id]; //only add if this error was previously unreported
         this->curr_errors[err_id] = true;
+        this->on_error.cancel();
     }
 
     void reset_error(Error const err) {
         auto const err_id = to_id(err);
         this->nr_errors -= this->curr_errors[err_id]; //only subtract if this error was previously reported
+        this->curr_errors[err_id] = false;
+        if (!this->nr_errors) {
+            this->on_error.reset();
+        }
     }
 
     void set_active() {
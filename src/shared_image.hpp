@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <new>
+
+#include "mapped_file.hpp"
+#include "seqlock.hpp"
+#include "trace.hpp"
+
+
+//machine state published once per tick for other processes on the same machine (HMI, SCADA, ...).
+//the published data is the same record that is traced, only the timing information is of less interest here.
+struct SharedImageSegment {
+    static constexpr std::array<char, 8> expected_magic = { 'P', 'A', 'L', 'I', 'M', 'A', 'G', 'E' };
+    static constexpr std::uint32_t expected_version = 3;
+
+    std::array<char, 8> magic = expected_magic;
+    std::uint32_t version = expected_version;
+    Seqlock<TraceRecord> image = {};
+}; //struct SharedImageSegment
+
+
+//owned by the scan loop. publishing never waits on a reader.
+class ImagePublisher {
+    SharedMemory memory;
+    SharedImageSegment* segment = nullptr;
+
+public:
+    ImagePublisher(char const* const name)
+        :memory(name, sizeof(SharedImageSegment), SharedMemory::Access::Create)
+    {
+        if (this->memory) {
+            this->segment = new (this->memory.data()) SharedImageSegment{};
+        }
+    }
+
+    explicit operator bool() const { return this->segment != nullptr; }
+
+    void publish(TraceRecord const& record) {
+        this->segment->image.write(record);
+    }
+}; //class ImagePublisher
+
+
+//any number of these may poll the same segment.
+class ImageReader {
+    SharedMemory memory;
+    SharedImageSegment const* segment = nullptr;
+
+public:
+    ImageReader(char const* const name)
+        :memory(name, sizeof(SharedImageSegment), SharedMemory::Access::ReadOnly)
+    {
+        SharedImageSegment const* const seg = (SharedImageSegment const*)this->memory.data();
+        if (seg && seg->magic == SharedImageSegment::expected_magic && seg->version == SharedImageSegment::expected_version) {
+            this->segment = seg;
+        }
+    }
+
+    explicit operator bool() const { return this->segment != nullptr; }
+
+    //returns false if no consistent image could be read in max_tries attempts
+    //(only happens if the publisher is descheduled in the middle of a write)
+    bool read(TraceRecord& result, int const max_tries = 1000) const {
+        for (int i = 0; i < max_tries; i++) {
+            if (this->segment->image.try_read(result)) return true;
+        }
+        return false;
+    }
+
+    std::uint64_t nr_publications() const { return this->segment->image.version(); }
+}; //class ImageReader
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <limits>
+#include <span>
+#include <vector>
+
+
+//handle of an element of a SlotMap. stays valid while the element is in the map, other elements coming and going
+//do not affect it. once the element is removed, the handle is stale and never refers to anything again
+//(unless the 32 bit generation of its slot wraps around).
+struct SlotHandle {
+    std::uint32_t slot = std::numeric_limits<std::uint32_t>::max();
+    std::uint32_t generation = 0;
+};
+
+//unordered set of values with O(1) insert, remove and lookup per handle.
+//the values are kept densely in one vector (removing moves the last value into the gap), thus iterating
+//touches nothing but the values themselves. slots are only ever reused, never freed.
+template<typename T>
+class SlotMap {
+    static constexpr std::uint32_t no_slot = std::numeric_limits<std::uint32_t>::max();
+
+    struct Slot {
+        std::uint32_t dense_index; //index into values if in use, next free slot otherwise
+        std::uint32_t generation;  //odd while in use
+    };
+
+    std::vector<T> dense_values;
+    std::vector<std::uint32_t> dense_to_slot; //parallel to dense_values
+    std::vector<Slot> slots;
+    std::uint32_t first_free = no_slot;
+
+    Slot const* slot_of(SlotHandle const handle) const {
+        if (handle.slot >= this->slots.size()) return nullptr;
+        Slot const& slot = this->slots[handle.slot];
+        return slot.generation == handle.generation ? &slot : nullptr;
+    }
+
+public:
+    SlotHandle insert(T value) {
+        std::uint32_t slot_index = this->first_free;
+        if (slot_index == no_slot) {
+            slot_index = (std::uint32_t)this->slots.size();
+            this->slots.push_back(Slot{ 0, 0 });
+        }
+        else {
+            this->first_free = this->slots[slot_index].dense_index;
+        }
+        Slot& slot = this->slots[slot_index];
+        slot.dense_index = (std::uint32_t)this->dense_values.size();
+        slot.generation++;
+        this->dense_values.push_back(std::move(value));
+        this->dense_to_slot.push_back(slot_index);
+        return SlotHandle{ slot_index, slot.generation };
+    }
+
+    //the handle must be valid
+    void remove(SlotHandle const handle) {
+        assert(this->contains(handle));
+        Slot& slot = this->slots[handle.slot];
+        std::uint32_t const gap = slot.dense_index;
+        std::uint32_t const last = (std::uint32_t)this->dense_values.size() - 1;
+        if (gap != last) {
+            this->dense_values[gap] = std::move(this->dense_values[last]);
+            this->dense_to_slot[gap] = this->dense_to_slot[last];
+            this->slots[this->dense_to_slot[gap]].dense_index = gap;
+        }
+        this->dense_values.pop_back();
+        this->dense_to_slot.pop_back();
+        slot.generation++;
+        slot.dense_index = this->first_free;
+        this->first_free = handle.slot;
+    }
+
+    bool contains(SlotHandle const handle) const { return this->slot_of(handle) != nullptr; }
+
+    //nullptr if the handle is stale
+    T* find(SlotHandle const handle) {
+        Slot const* const slot = this->slot_of(handle);
+        return slot ? &this->dense_values[slot->dense_index] : nullptr;
+    }
+
+    std::size_t size() const { return this->dense_values.size(); }
+
+    //in no particular order, invalidated by insert and remove
+    std::span<T> values() { return this->dense_values; }
+    std::span<T const> values() const { return this->dense_values; }
+}; //class SlotMap
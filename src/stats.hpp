@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <ostream>
+#include <vector>
+
+
+//count, sum, minimum and maximum of a series of values
+struct RunningStats {
+    std::uint64_t count = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+
+    void add(double const x) {
+        this->count++;
+        this->sum += x;
+        this->min = std::min(this->min, x);
+        this->max = std::max(this->max, x);
+    }
+
+    RunningStats scaled(double const factor) const {
+        RunningStats result = *this;
+        result.sum *= factor;
+        result.min *= factor;
+        result.max *= factor;
+        return result;
+    }
+
+    void print(std::ostream& out, char const* const unit) const {
+        if (!this->count) {
+            out << "-\n";
+            return;
+        }
+        out << "n = " << this->count
+            << ", min " << this->min << unit
+            << ", avg " << this->sum / this->count << unit
+            << ", max " << this->max << unit << "\n";
+    }
+}; //struct RunningStats
+
+
+//every value of a series, for percentiles. only for series that easily fit into memory.
+struct Distribution {
+    std::vector<double> values;
+
+    void add(double const x) { this->values.push_back(x); }
+
+    //p in [0, 1], nearest rank
+    double percentile(double const p) const {
+        std::vector<double> sorted = this->values;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[(std::size_t)(p * (sorted.size() - 1) + 0.5)];
+    }
+
+    void print(std::ostream& out, char const* const unit) const {
+        if (this->values.empty()) {
+            out << "-\n";
+            return;
+        }
+        double sum = 0;
+        for (double const x : this->values) sum += x;
+        out << "n = " << this->values.size()
+            << ", min " << this->percentile(0) << unit
+            << ", p10 " << this->percentile(0.1) << unit
+            << ", p50 " << this->percentile(0.5) << unit
+            << ", p90 " << this->percentile(0.9) << unit
+            << ", max " << this->percentile(1) << unit
+            << ", avg " << sum / this->values.size() << unit << "\n";
+    }
+}; //struct Distribution
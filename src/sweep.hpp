@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+
+//runs job(0) ... job(nr_jobs - 1), at most nr_threads of them at once.
+//the simulation keeps its state in thread_local variables (process image, scheduler, coroutine stacks, plant ...),
+//thus every job gets a thread of its own and starts from the same state a fresh program does.
+//starting a thread costs far less than a simulation run, so this is not worth a pool with explicit resets.
+template<typename Job>
+void run_jobs(std::size_t const nr_jobs, std::size_t const nr_threads, Job const& job) {
+    std::atomic<std::size_t> next_job = 0;
+    auto const worker = [&] {
+        while (true) {
+            std::size_t const i = next_job.fetch_add(1, std::memory_order_relaxed);
+            if (i >= nr_jobs) return;
+            std::thread(job, i).join();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < std::max<std::size_t>(1, std::min(nr_threads, nr_jobs)); i++) {
+        workers.emplace_back(worker);
+    }
+    for (std::thread& t : workers) {
+        t.join();
+    }
+}
@@ -1,12 +1,15 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
+#include <thread>
 
 
 class Tick {
 	//different standard libraries use different types as result of ...::now()
 	decltype(std::chrono::high_resolution_clock::now()) start;
 	std::chrono::nanoseconds period; //length of one tick
+	std::uint64_t nr_ticks = 0; //number of completed ticks
 
 public:
 	Tick(std::chrono::nanoseconds period) :
@@ -14,11 +17,16 @@ public:
 		period(period)
 	{}
 
+	std::uint64_t curr_tick() const { return this->nr_ticks; }
+	std::chrono::nanoseconds tick_period() const { return this->period; }
+	std::chrono::nanoseconds curr_tick_start() const { return this->start.time_since_epoch(); }
+
 	//waits for the time remaining between now and start of tick + period
 	//returns the required waittime
 	std::chrono::nanoseconds wait_till_end_of_tick() {
 		auto const now = std::chrono::high_resolution_clock::now();
 		auto const curr_duration = now - this->start;
+		this->nr_ticks++;
 
 		if (curr_duration < this->period) {
 			this->start += this->period;
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <array>
+#include <algorithm>
+
+
+//element of an intrusive list. lives wherever the owner of the timer lives (usually inside a coroutine frame),
+//thus neither inserting nor cancelling a timer allocates.
+class TimerNode {
+    TimerNode* next = nullptr;
+    TimerNode** prev_next = nullptr; //address of the pointer pointing to this node, nullptr if not linked
+    std::uint64_t deadline = 0;
+    void (*callback)(void*) = nullptr;
+    void* context = nullptr;
+
+    friend class TimerWheel;
+
+public:
+    //callback(context) is called once the deadline is reached
+    constexpr TimerNode(void (*const callback)(void*), void* const context)
+        :callback(callback), context(context)
+    {}
+
+    TimerNode(TimerNode const&) = delete;
+    TimerNode& operator=(TimerNode const&) = delete;
+
+    //a node may not be destroyed while linked, use TimerWheel::cancel first
+    ~TimerNode() { assert(!this->is_pending()); }
+
+    bool is_pending() const { return this->prev_next != nullptr; }
+    std::uint64_t deadline_tick() const { return this->deadline; }
+
+    void unlink() {
+        if (this->prev_next) {
+            *this->prev_next = this->next;
+            if (this->next) this->next->prev_next = this->prev_next;
+            this->next = nullptr;
+            this->prev_next = nullptr;
+        }
+    }
+}; //class TimerNode
+
+
+//hierarchical timer wheel: level 0 has one slot per tick for the next 64 ticks, level 1 one slot per 64 ticks
+//for the next 64^2 ticks and so on. whenever a lower level completes a revolution, the next slot of the level above
+//is cascaded down. inserting and cancelling are O(1), advancing one tick only looks at timers that fire
+//(plus each timer once per level it cascades through).
+class TimerWheel {
+    static constexpr std::size_t bits_per_level = 6;
+    static constexpr std::size_t nr_slots = std::size_t(1) << bits_per_level;
+    static constexpr std::size_t nr_levels = 4;
+    static constexpr std::uint64_t slot_mask = nr_slots - 1;
+    //timers further away wait in the last level and are cascaded (not fired) once per revolution of that level
+    static constexpr std::uint64_t max_delta = (std::uint64_t(1) << (bits_per_level * nr_levels)) - 1;
+
+    std::array<std::array<TimerNode*, nr_slots>, nr_levels> levels = {};
+    std::uint64_t curr_tick = 0; //all timers with deadline <= curr_tick have fired
+
+    void link(TimerNode& node) {
+        std::uint64_t const delta = node.deadline - this->curr_tick;
+        std::size_t level = 0;
+        while (level + 1 < nr_levels && delta >= (std::uint64_t(1) << (bits_per_level * (level + 1)))) {
+            level++;
+        }
+        std::uint64_t const slot_tick = this->curr_tick + std::min(delta, max_delta);
+        TimerNode*& head = this->levels[level][(slot_tick >> (bits_per_level * level)) & slot_mask];
+        node.next = head;
+        node.prev_next = &head;
+        if (head) head->prev_next = &node.next;
+        head = &node;
+    }
+
+    //moves every timer of the given slot one (or more) levels down
+    void cascade(std::size_t const level, std::size_t const slot) {
+        TimerNode* iter = this->levels[level][slot];
+        this->levels[level][slot] = nullptr;
+        while (iter) {
+            TimerNode* const node = iter;
+            iter = iter->next;
+            node->next = nullptr;
+            node->prev_next = nullptr;
+            this->link(*node);
+        }
+    }
+
+public:
+    constexpr TimerWheel() {}
+
+    std::uint64_t now() const { return this->curr_tick; }
+
+    //deadlines not in the future fire at the next call of advance
+    void insert(TimerNode& node, std::uint64_t const deadline) {
+        assert(!node.is_pending());
+        node.deadline = deadline > this->curr_tick ? deadline : this->curr_tick + 1;
+        this->link(node);
+    }
+
+    static void cancel(TimerNode& node) { node.unlink(); }
+
+    //fires every timer with deadline <= to_tick.
+    //callbacks may not insert or cancel other timers.
+    void advance(std::uint64_t const to_tick) {
+        while (this->curr_tick < to_tick) {
+            this->curr_tick++;
+            for (std::size_t level = 1; level < nr_levels; level++) {
+                //a lower level just completed a revolution?
+                if ((this->curr_tick >> (bits_per_level * (level - 1))) & slot_mask) break;
+                this->cascade(level, (this->curr_tick >> (bits_per_level * level)) & slot_mask);
+            }
+            TimerNode*& head = this->levels[0][this->curr_tick & slot_mask];
+            while (head) {
+                TimerNode* const node = head;
+                assert(node->deadline == this->curr_tick);
+                node->unlink();
+                node->callback(node->context);
+            }
+        }
+    }
+}; //class TimerWheel
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <array>
+#include <span>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <iostream>
+#include <type_traits>
+
+#include "mapped_file.hpp"
+#include "stats.hpp"
+
+
+//one record per tick. exactly one cache line, so the realtime thread only ever touches a single line per tick.
+constexpr std::size_t trace_nr_palettes = 2;
+
+struct TraceRecord {
+    std::uint64_t tick;
+    std::int64_t start_ns; //start of tick (clock epoch is implementation defined, only differences matter)
+    std::int64_t slack_ns; //time left after the tick was computed, negative if the tick took too long
+    std::int64_t x, y, z; //arm position in micrometres
+    std::uint32_t error_bits;
+    std::array<std::uint16_t, trace_nr_palettes> nr_boxes; //per palette station
+    std::array<std::uint8_t, trace_nr_palettes> mag_state; //per palette station
+    std::uint8_t active_palette; //station the arm stacks on
+    std::uint8_t gripper; //see TraceGripper
+    std::uint8_t arm_state;
+    std::uint8_t inlet_state;
+    std::uint8_t inlet_queue; //boxes waiting upstream of the pickup position
+    std::uint8_t reserved;
+};
+static_assert(sizeof(TraceRecord) == 64);
+static_assert(std::is_trivially_copyable_v<TraceRecord>);
+
+enum class TraceGripper : std::uint8_t { Moving, Extended, Retracted, COUNT };
+
+struct TraceHeader {
+    static constexpr std::array<char, 8> expected_magic = { 'P', 'A', 'L', 'T', 'R', 'A', 'C', 'E' };
+    static constexpr std::uint32_t expected_version = 3;
+
+    std::array<char, 8> magic = expected_magic;
+    std::uint32_t version = expected_version;
+    std::uint32_t record_size = sizeof(TraceRecord);
+    std::uint64_t capacity = 0;
+    std::uint64_t nr_records = 0; //updated after every record, thus a crashed program still leaves a valid file
+    std::int64_t tick_period_ns = 0;
+    std::array<char, 24> reserved = {};
+
+    bool is_valid() const {
+        return this->magic == expected_magic
+            && this->version == expected_version
+            && this->record_size == sizeof(TraceRecord)
+            && this->nr_records <= this->capacity;
+    }
+};
+static_assert(sizeof(TraceHeader) == sizeof(TraceRecord)); //records stay cache line alligned
+
+
+//writes TraceRecords into a ring of preallocated memory mapped files named <base>.<index>.trace
+//once all files are full, the oldest one is overwritten.
+//write() is a memcpy plus a counter increment. the next file is created, mapped and touched in advance by a helper
+//thread, thus once a file is full write() only swaps it in (and the helper releases the full one).
+//the next file is emptied as soon as it is prepared, thus the ring keeps nr_files - 1 full files.
+//if the helper has not finished in time (a whole file earlier), records are dropped instead of waiting for it.
+//the same if it failed to create the next file, it then tries again (with the same index).
+class TraceWriter {
+    enum class Next { Preparing, Ready, Stopping };
+
+    std::string base_path;
+    std::size_t records_per_file;
+    std::size_t nr_files;
+    std::int64_t tick_period_ns;
+    std::size_t next_index = 0; //helper thread only
+    bool retrying = false; //helper thread only, creating the file at next_index failed before
+
+    MappedFile file = {};
+    TraceHeader* header = nullptr;
+    TraceRecord* records = nullptr;
+    std::uint64_t nr_dropped = 0;
+
+    //owned by the helper thread while Preparing, by the writing thread while Ready
+    MappedFile next_file = {};
+    std::atomic<Next> next_state = Next::Preparing;
+    std::thread helper;
+
+    //report = false: a failure is not printed (retries of a file that could not be created)
+    MappedFile open_file(std::size_t const index, bool const report = true) const {
+        std::string const path = this->base_path + "." + std::to_string(index) + ".trace";
+        std::size_t const size = sizeof(TraceHeader) + this->records_per_file * sizeof(TraceRecord);
+        MappedFile result(path.c_str(), size);
+        if (!result) {
+            if (report) std::cerr << "unable to create trace file " << path << "\n";
+            return result;
+        }
+        //the file is sparse, writing a page the first time would cause a page fault (and allocate disk space)
+        for (std::size_t offset = 0; offset < size; offset += 4096) {
+            ((char volatile*)result.data())[offset] = 0;
+        }
+        TraceHeader* const header = new (result.data()) TraceHeader{};
+        header->capacity = this->records_per_file;
+        header->tick_period_ns = this->tick_period_ns;
+        return result;
+    }
+
+    void point_into_file() {
+        this->header = this->file ? (TraceHeader*)this->file.data() : nullptr;
+        this->records = this->file ? (TraceRecord*)(this->header + 1) : nullptr;
+    }
+
+    void prepare_files() {
+        while (true) {
+            this->next_state.wait(Next::Ready);
+            if (this->next_state.load() == Next::Stopping) return;
+            this->next_file = {}; //the full file swapped out by write
+            this->next_file = this->open_file(this->next_index, !this->retrying);
+            this->retrying = !this->next_file;
+            if (this->next_file) {
+                this->next_index = (this->next_index + 1) % this->nr_files;
+            }
+            Next expected = Next::Preparing;
+            if (!this->next_state.compare_exchange_strong(expected, Next::Ready)) return;
+        }
+    }
+
+public:
+    //default: one file per hour of 10ms ticks, one shift fits into the ring
+    TraceWriter(std::string base_path, std::chrono::nanoseconds const tick_period,
+        std::size_t const records_per_file = 360'000, std::size_t const nr_files = 9)
+        :base_path(std::move(base_path)),
+        records_per_file(records_per_file),
+        nr_files(nr_files),
+        tick_period_ns(tick_period.count())
+    {
+        assert(nr_files >= 2); //the next file is prepared while the current one is written
+        this->file = this->open_file(0);
+        this->point_into_file();
+        this->next_index = 1;
+        if (this->header) {
+            this->helper = std::thread([this] { this->prepare_files(); });
+        }
+    }
+
+    TraceWriter(TraceWriter const&) = delete;
+    TraceWriter& operator=(TraceWriter const&) = delete;
+
+    ~TraceWriter() {
+        if (this->helper.joinable()) {
+            this->next_state.store(Next::Stopping);
+            this->next_state.notify_one();
+            this->helper.join();
+        }
+        if (this->nr_dropped) {
+            std::cerr << "trace: " << this->nr_dropped << " records dropped, the next file was not ready in time (or not created)\n";
+        }
+    }
+
+    explicit operator bool() const { return this->header != nullptr; }
+
+    void write(TraceRecord const& record) {
+        if (!this->header) return;
+        if (this->header->nr_records == this->header->capacity) {
+            if (this->next_state.load(std::memory_order_acquire) != Next::Ready) {
+                this->nr_dropped++;
+                return;
+            }
+            bool const created = (bool)this->next_file;
+            if (created) {
+                std::swap(this->file, this->next_file); //only pointers, releasing the full file is left to the helper
+                this->point_into_file();
+            }
+            this->next_state.store(Next::Preparing, std::memory_order_release);
+            this->next_state.notify_one();
+            if (!created) {
+                //the full file is kept, the helper tries again
+                this->nr_dropped++;
+                return;
+            }
+        }
+        std::memcpy(this->records + this->header->nr_records, &record, sizeof(TraceRecord));
+        this->header->nr_records++;
+    }
+}; //class TraceWriter
+
+
+//human readable names of the enumerators traced, indexed by the enumerators value
+struct TraceStateNames {
+    std::span<char const* const> arm;
+    std::span<char const* const> mag;
+    std::span<char const* const> inlet;
+};
+
+namespace trace_detail {
+
+    //measures how many ticks one enum keeps the same value
+    struct DwellTimes {
+        std::span<char const* const> names;
+        std::vector<RunningStats> per_state;
+        std::uint8_t curr_state = 0;
+        std::uint64_t since_tick = 0;
+        bool started = false;
+
+        DwellTimes(std::span<char const* const> names) :names(names), per_state(std::max<std::size_t>(names.size(), 1)) {}
+
+        void add(std::uint8_t const state, std::uint64_t const tick) {
+            if (!this->started) {
+                this->started = true;
+                this->curr_state = state;
+                this->since_tick = tick;
+            }
+            else if (state != this->curr_state) {
+                if (this->curr_state >= this->per_state.size()) this->per_state.resize(this->curr_state + 1);
+                this->per_state[this->curr_state].add((double)(tick - this->since_tick));
+                this->curr_state = state;
+                this->since_tick = tick;
+            }
+        }
+
+        void print(std::ostream& out, char const* const title, double const ms_per_tick) const {
+            out << title << " state dwell times:\n";
+            for (std::size_t i = 0; i < this->per_state.size(); i++) {
+                RunningStats const& s = this->per_state[i];
+                if (!s.count) continue;
+                out << "  " << (i < this->names.size() ? this->names[i] : "?") << ": ";
+                s.scaled(ms_per_tick).print(out, "ms");
+            }
+        }
+    };
+
+} //namespace trace_detail
+
+//reads the given trace files (in any order) and prints cycle times, state dwell times and overrun statistics.
+//returns the process exit code.
+inline int analyze_trace(std::span<char const* const> const paths, TraceStateNames const& names, std::ostream& out) {
+    using namespace trace_detail;
+
+    std::vector<MappedFile> files;
+    for (char const* const path : paths) {
+        MappedFile file(path, 0, false);
+        if (!file || file.size() < sizeof(TraceHeader) || !((TraceHeader const*)file.data())->is_valid()) {
+            std::cerr << "skipping " << path << ": not a trace file\n";
+            continue;
+        }
+        TraceHeader const* const header = (TraceHeader const*)file.data();
+        if (header->nr_records && file.size() >= sizeof(TraceHeader) + header->nr_records * sizeof(TraceRecord)) {
+            files.push_back(std::move(file));
+        }
+    }
+    if (files.empty()) {
+        std::cerr << "no records found\n";
+        return 1;
+    }
+    auto const first_record = [](MappedFile const& f) { return (TraceRecord const*)((TraceHeader const*)f.data() + 1); };
+    std::sort(files.begin(), files.end(), [&](MappedFile const& a, MappedFile const& b) {
+        return first_record(a)->tick < first_record(b)->tick;
+    });
+
+    std::int64_t const period_ns = ((TraceHeader const*)files.front().data())->tick_period_ns;
+    double const ms_per_tick = period_ns / 1e6;
+
+    RunningStats cycle_ticks;
+    RunningStats scan_ms;
+    RunningStats overrun_ms;
+    RunningStats inlet_queue;
+    std::uint64_t longest_overrun_streak = 0;
+    std::uint64_t curr_overrun_streak = 0;
+    std::uint64_t nr_missing_ticks = 0;
+    DwellTimes arm(names.arm);
+    std::array<DwellTimes, trace_nr_palettes> mag = { DwellTimes(names.mag), DwellTimes(names.mag) };
+    DwellTimes inlet(names.inlet);
+
+    bool has_prev = false;
+    TraceRecord prev = {};
+    std::uint64_t last_box_tick = 0;
+    bool has_box_tick = false;
+
+    for (MappedFile const& file : files) {
+        TraceHeader const* const header = (TraceHeader const*)file.data();
+        std::span<TraceRecord const> const records(first_record(file), header->nr_records);
+        for (TraceRecord const& rec : records) {
+            if (has_prev) {
+                if (rec.tick <= prev.tick) continue; //overlapping files
+                nr_missing_ticks += rec.tick - prev.tick - 1;
+                bool box_placed = false;
+                for (std::size_t i = 0; i < trace_nr_palettes; i++) {
+                    box_placed |= rec.nr_boxes[i] == prev.nr_boxes[i] + 1;
+                }
+                if (box_placed) {
+                    if (has_box_tick) {
+                        cycle_ticks.add((double)(rec.tick - last_box_tick));
+                    }
+                    last_box_tick = rec.tick;
+                    has_box_tick = true;
+                }
+            }
+            scan_ms.add((period_ns - rec.slack_ns) / 1e6);
+            if (rec.slack_ns < 0) {
+                overrun_ms.add(-rec.slack_ns / 1e6);
+                curr_overrun_streak++;
+                longest_overrun_streak = std::max(longest_overrun_streak, curr_overrun_streak);
+            }
+            else {
+                curr_overrun_streak = 0;
+            }
+            arm.add(rec.arm_state, rec.tick);
+            for (std::size_t i = 0; i < trace_nr_palettes; i++) {
+                mag[i].add(rec.mag_state[i], rec.tick);
+            }
+            inlet.add(rec.inlet_state, rec.tick);
+            inlet_queue.add(rec.inlet_queue);
+            prev = rec;
+            has_prev = true;
+        }
+    }
+
+    out << "ticks: " << scan_ms.count << " (" << nr_missing_ticks << " missing), tick period " << ms_per_tick << "ms\n";
+    out << "cycle time per box: ";
+    cycle_ticks.scaled(ms_per_tick).print(out, "ms");
+    out << "scan time: ";
+    scan_ms.print(out, "ms");
+    out << "overruns: ";
+    overrun_ms.print(out, "ms");
+    out << "longest overrun streak: " << longest_overrun_streak << " ticks\n";
+    arm.print(out, "arm", ms_per_tick);
+    for (std::size_t i = 0; i < trace_nr_palettes; i++) {
+        mag[i].print(out, ("magazine " + std::to_string(i)).c_str(), ms_per_tick);
+    }
+    inlet.print(out, "inlet", ms_per_tick);
+    out << "inlet queue: ";
+    inlet_queue.print(out, " boxes");
+    return 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+
+//integer quantities with their unit in the type, e.g. a Length can neither be added to a Speed nor passed where
+//a plain number is expected. stored as a count of the smallest step (fixed point), thus exact and deterministic.
+//a Quantity is nothing but its count, all operations are constexpr and trivially inlined: no cost in release builds,
+//arrays of quantities have the same layout as arrays of std::int64_t.
+template<typename Unit>
+class Quantity {
+    std::int64_t value = 0;
+
+public:
+    constexpr Quantity() = default;
+    constexpr explicit Quantity(std::int64_t const count) :value(count) {}
+
+    //in the smallest step of Unit
+    constexpr std::int64_t count() const { return this->value; }
+
+    static constexpr Quantity max() { return Quantity(std::numeric_limits<std::int64_t>::max()); }
+
+    constexpr Quantity operator-() const { return Quantity(-this->value); }
+    constexpr Quantity& operator+=(Quantity const other) { this->value += other.value; return *this; }
+    constexpr Quantity& operator-=(Quantity const other) { this->value -= other.value; return *this; }
+
+    friend constexpr Quantity operator+(Quantity const a, Quantity const b) { return Quantity(a.value + b.value); }
+    friend constexpr Quantity operator-(Quantity const a, Quantity const b) { return Quantity(a.value - b.value); }
+    friend constexpr Quantity operator*(Quantity const a, std::int64_t const factor) { return Quantity(a.value * factor); }
+    friend constexpr Quantity operator*(std::int64_t const factor, Quantity const a) { return Quantity(a.value * factor); }
+    friend constexpr Quantity operator/(Quantity const a, std::int64_t const divisor) { return Quantity(a.value / divisor); }
+    friend constexpr Quantity operator%(Quantity const a, Quantity const b) { return Quantity(a.value % b.value); }
+    //how often b fits into a, rounded towards zero
+    friend constexpr std::int64_t operator/(Quantity const a, Quantity const b) { return a.value / b.value; }
+
+    friend constexpr auto operator<=>(Quantity const, Quantity const) = default;
+    friend constexpr bool operator==(Quantity const, Quantity const) = default;
+}; //class Quantity
+
+template<typename Unit>
+constexpr Quantity<Unit> abs(Quantity<Unit> const q) { return q.count() < 0 ? -q : q; }
+
+//how often b fits into a, rounded up. both positive.
+template<typename Unit>
+constexpr std::int64_t ceil_div(Quantity<Unit> const a, Quantity<Unit> const b) { return (a.count() + b.count() - 1) / b.count(); }
+
+
+namespace units {
+    struct Micrometre;
+    struct MicrometrePerTick;
+    struct Tick;
+}
+
+using Length = Quantity<units::Micrometre>;
+using Speed = Quantity<units::MicrometrePerTick>;
+using Ticks = Quantity<units::Tick>; //a duration, not a point in time
+
+static_assert(sizeof(Length) == sizeof(std::int64_t) && std::is_trivially_copyable_v<Length>);
+
+constexpr Length operator*(Speed const speed, Ticks const duration) { return Length(speed.count() * duration.count()); }
+constexpr Length operator*(Ticks const duration, Speed const speed) { return speed * duration; }
+constexpr Speed operator/(Length const distance, Ticks const duration) { return Speed(distance.count() / duration.count()); }
+//ticks needed to cover distance (positive) at speed, the last one maybe only partly used
+constexpr Ticks ticks_to_cover(Length const distance, Speed const speed) {
+    return Ticks((distance.count() + speed.count() - 1) / speed.count());
+}
+
+namespace units::literals {
+    constexpr Length operator""_mm(unsigned long long const v) { return Length((std::int64_t)v * 1000); }
+    constexpr Speed operator""_mm_per_tick(unsigned long long const v) { return Speed((std::int64_t)v * 1000); }
+    constexpr Ticks operator""_ticks(unsigned long long const v) { return Ticks((std::int64_t)v); }
+}
+
+constexpr Speed millimetres_per_tick(std::int64_t const mm) { return Speed(mm * 1000); }